@@ -354,9 +354,12 @@ namespace velodyne
                   for( int laser_index = 0; laser_index < LASER_PER_FIRING; laser_index++ ){
                       // Retrieve Rotation Azimuth
                       double azimuth = static_cast<double>( firing_data.rotationalPosition );
-                      double laser_relative_time = LASER_PER_FIRING * time_between_firings + time_half_idle* (laser_index / MAX_NUM_LASERS);
+                      // Time of the laser within its firing block, and within the packet
+                      const double firing_relative_time = time_between_firings * ( laser_index % MAX_NUM_LASERS )
+                                                        + ( MAX_NUM_LASERS * time_between_firings + time_half_idle ) * ( laser_index / MAX_NUM_LASERS );
+                      const double laser_relative_time = time_total_cycle * firing_index + firing_relative_time;
 
-                      azimuth += azimuth_delta * laser_relative_time / time_total_cycle;
+                      azimuth += azimuth_delta * firing_relative_time / time_total_cycle;
 
                       // Reset Rotation Azimuth
                       if( azimuth >= 36000 )
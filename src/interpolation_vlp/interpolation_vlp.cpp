@@ -1,3 +1,6 @@
+// Custom point type, instantiate PCL templates from their headers
+#define PCL_NO_PRECOMPILE
+
 #include <iostream>
 #include <vector>
 #include <fstream>
@@ -25,6 +28,7 @@
 
 #include "cmdline.hpp"
 #include "imu_calls.hpp"
+#include "point_types.hpp"
 
 // #define HOST "localhost"
 // #define PORT 4223
@@ -127,7 +131,7 @@ int main( int argc, char **argv )
     imu_data.close();
 
     // Initialize pcl point cloud with point type -> used for pcd file
-    pcl::PointCloud<pcl::PointXYZRGBL> cloud;
+    pcl::PointCloud<PointXYZRGBLT> cloud;
 
     // Initialize some loop variables
     int number = 0; // Counter for number of pcds in one 360 degree frame
@@ -272,10 +276,19 @@ int main( int argc, char **argv )
             // adding the laser vertical component to the point label
             cloud.points[j].label = laser.vertical;
 
+            // firing time relative to the first return, made relative to the packet timestamp below
+            cloud.points[j].time = static_cast<float>(laser.time - lasers.front().time);
+
             // Increment counter
             j++;
         }
 
+        // The packet timestamp is the time of the last return
+        const float packet_time = static_cast<float>(timestamp - lasers.front().time);
+        for (int k = 0; k < j; ++k) {
+            cloud.points[k].time -= packet_time;
+        }
+
         // If all pcd points are inside scope, then write the pcd
         if (write_pcd and cloud.size() > 0)
         {
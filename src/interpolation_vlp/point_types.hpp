@@ -0,0 +1,27 @@
+#pragma once
+
+// PCL
+#include <pcl/point_types.h>
+#include <pcl/register_point_struct.h>
+
+/*
+ * PointXYZRGBL extended with the firing time of the return, in microseconds relative
+ * to the datapacket timestamp written to quaternions_datapacket.csv. The timestamp is
+ * the time of the last return of the packet, so the time field is never positive.
+ */
+struct EIGEN_ALIGN16 PointXYZRGBLT
+{
+    PCL_ADD_POINT4D;
+    PCL_ADD_RGB;
+    std::uint32_t label;
+    float time;
+    PCL_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+POINT_CLOUD_REGISTER_POINT_STRUCT(PointXYZRGBLT,
+                                  (float, x, x)
+                                  (float, y, y)
+                                  (float, z, z)
+                                  (float, rgb, rgb)
+                                  (std::uint32_t, label, label)
+                                  (float, time, time))
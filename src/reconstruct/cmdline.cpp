@@ -11,6 +11,22 @@ namespace po = boost::program_options;
 CmdLine::CmdLine( int argc, char** argv )
     : _visualize( false )
     , _icp( "generalized" )
+    , _interpolation( "slerp" )
+    , _deskew( false )
+    , _save_scans( false )
+    , _compose_odometry( false )
+    , _odometry( "icp" )
+    , _imu_prior( false )
+    , _keyframe_distance( 0 )
+    , _registration( "incremental" )
+    , _submap_fragments( 0 )
+    , _submap_radius( 0 )
+    , _map_resolution( 0 )
+    , _loop_closures( 0 )
+    , _pyramid( false )
+    , _coarse_alignment( false )
+    , _jobs( 0 )
+    , _memory_limit_gb( 0 )
 {
     po::positional_options_description p;
     p.add("data-dir", -1);
@@ -24,7 +40,72 @@ CmdLine::CmdLine( int argc, char** argv )
           "Visualize the reconstruction" )
         ( "icp",
           po::value<std::string>(&_icp),
-          "The ICP algorithm to use: generalized, non-linear or symmetric (only with PCL>=1.10)" )
+          "The ICP algorithm to use: generalized, non-linear, symmetric (only with PCL>=1.10), "
+          "point-to-plane, point-to-plane-symmetric, vgicp (multi-threaded, in-house), gravity (levels "
+          "the fragments with the recorded IMU gravity and solves yaw and translation only) or "
+          "gravity-refined (gravity followed by a small-angle refinement of all 6 DOF)" )
+        ( "interpolation",
+          po::value<std::string>(&_interpolation),
+          "Orientation interpolation between IMU readings: slerp or squad" )
+        ( "deskew",
+          po::bool_switch(&_deskew)->default_value(false),
+          "Rotate every firing block of a datapacket with the orientation at its own firing time "
+          "instead of one orientation per datapacket. For odometry walks and fast tripod sweeps" )
+        ( "save-scans",
+          po::bool_switch(&_save_scans)->default_value(false),
+          "Also write the combined odometry scans to odometry_<i>/scans (in the background)" )
+        ( "compose-odometry",
+          po::bool_switch(&_compose_odometry)->default_value(false),
+          "Compose the full scan to scan transformations of an odometry run instead of summing "
+          "their translations, for walks where the IMU orientation drifts" )
+        ( "odometry",
+          po::value<std::string>(&_odometry),
+          "Odometry scan alignment: icp (non-linear ICP on kd-trees, pairs in parallel), projective "
+          "(point-to-plane ICP with projective data association on the range images) or loam (ICP on "
+          "the edge and planar points of the range images)" )
+        ( "imu-prior",
+          po::bool_switch(&_imu_prior)->default_value(false),
+          "Integrate the IMU rates in imu_data.csv between consecutive odometry scans into an initial "
+          "guess and a prior of their alignment (with --odometry projective or loam)" )
+        ( "keyframe-distance",
+          po::value<float>(&_keyframe_distance),
+          "Register only odometry scans whose returns moved at least this far in meters (median change "
+          "of range) from the last registered scan, e.g. 0.03 (default: 0, every scan)" )
+        ( "registration",
+          po::value<std::string>(&_registration),
+          "Fragment registration: incremental (every fragment against the map of the previous ones) or "
+          "pairwise (consecutive pairs independently and concurrently, then chained)" )
+        ( "submap-fragments",
+          po::value<unsigned>(&_submap_fragments),
+          "Register every fragment against the last N registered fragments only (default: 0, all)" )
+        ( "submap-radius",
+          po::value<float>(&_submap_radius),
+          "Register every fragment against the map points within this radius in meters of its "
+          "expected position only (default: 0, no limit)" )
+        ( "map-resolution",
+          po::value<float>(&_map_resolution),
+          "Merge the registered fragments into voxels of this size in meters, one point per voxel "
+          "(default: 0, plain concatenation)" )
+        ( "loop-closures",
+          po::value<unsigned>(&_loop_closures),
+          "Verify up to N revisited places found by place recognition with ICP and optimize the "
+          "fragment poses as a pose graph (default: 0, sequential registration only)" )
+        ( "pyramid",
+          po::bool_switch(&_pyramid)->default_value(false),
+          "Align the fragments coarse to fine on 20, 10 and 5 cm voxel grids instead of once on "
+          "the sampled clouds, reporting the time and fitness of every level" )
+        ( "coarse-alignment",
+          po::bool_switch(&_coarse_alignment)->default_value(false),
+          "Match FPFH descriptors of voxel keypoints and estimate the fragment alignment with RANSAC "
+          "before ICP, which then starts from it instead of the odometry translation if it explains "
+          "more matches. For fragments with a wrong odometry translation" )
+        ( "jobs,j",
+          po::value<unsigned>(&_jobs),
+          "Number of tasks (fragments, odometry runs, registration) processed concurrently "
+          "(default: number of hardware threads)" )
+        ( "memory-limit",
+          po::value<double>(&_memory_limit_gb),
+          "Memory in GB that concurrently processed fragments may use (default: 3/4 of the physical memory)" )
         ( "data-dir,d",
           po::value<std::string>(&_data_dir)->required(),
           "Directory where pointcloud fragments can be found (positional argument)" )
@@ -48,7 +129,12 @@ CmdLine::CmdLine( int argc, char** argv )
         else if (vm.count("icp"))
         {
             if( ( vm["icp"].as<std::string>() != "generalized" ) &&
-                ( vm["icp"].as<std::string>() != "non-linear" )
+                ( vm["icp"].as<std::string>() != "non-linear" ) &&
+                ( vm["icp"].as<std::string>() != "point-to-plane" ) &&
+                ( vm["icp"].as<std::string>() != "point-to-plane-symmetric" ) &&
+                ( vm["icp"].as<std::string>() != "vgicp" ) &&
+                ( vm["icp"].as<std::string>() != "gravity" ) &&
+                ( vm["icp"].as<std::string>() != "gravity-refined" )
                 #if PCL_VERSION_COMPARE(>, 1, 10, 0)
                 && ( vm["icp"].as<std::string>() != "symmetric" )
                 #endif
@@ -58,6 +144,21 @@ CmdLine::CmdLine( int argc, char** argv )
                         << desc << std::endl;
             }
         }
+        if( ( _interpolation != "slerp" ) && ( _interpolation != "squad" ) )
+        {
+            std::cerr << "Incorrect parameter for interpolation option." << std::endl
+                      << desc << std::endl;
+        }
+        if( ( _odometry != "icp" ) && ( _odometry != "projective" ) && ( _odometry != "loam" ) )
+        {
+            std::cerr << "Incorrect parameter for odometry option." << std::endl
+                      << desc << std::endl;
+        }
+        if( ( _registration != "incremental" ) && ( _registration != "pairwise" ) )
+        {
+            std::cerr << "Incorrect parameter for registration option." << std::endl
+                      << desc << std::endl;
+        }
     }
     catch (const po::error &ex)
     {
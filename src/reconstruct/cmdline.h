@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
 
 class CmdLine
@@ -10,10 +11,42 @@ public:
     const std::string& getDataDir() const { return _data_dir; }
     const std::string& getICPType() const { return _icp; }
     bool        getVisualize() const { return _visualize; }
+    const std::string& getInterpolation() const { return _interpolation; }
+    bool        getDeskew() const { return _deskew; }
+    bool        getSaveScans() const { return _save_scans; }
+    bool        getComposeOdometry() const { return _compose_odometry; }
+    const std::string& getOdometry() const { return _odometry; }
+    bool        getImuPrior() const { return _imu_prior; }
+    float       getKeyframeDistance() const { return _keyframe_distance; }
+    const std::string& getRegistration() const { return _registration; }
+    unsigned    getSubmapFragments() const { return _submap_fragments; }
+    float       getSubmapRadius() const { return _submap_radius; }
+    float       getMapResolution() const { return _map_resolution; }
+    unsigned    getLoopClosures() const { return _loop_closures; }
+    bool        getPyramid() const { return _pyramid; }
+    bool        getCoarseAlignment() const { return _coarse_alignment; }
+    unsigned    getJobs() const { return _jobs; }
+    std::size_t getMemoryLimit() const { return static_cast<std::size_t>(_memory_limit_gb * (1 << 30)); }
 
 private:
     std::string _data_dir;
     bool        _visualize;
     std::string _icp;
+    std::string _interpolation;
+    bool        _deskew;
+    bool        _save_scans;
+    bool        _compose_odometry;
+    std::string _odometry;
+    bool        _imu_prior;
+    float       _keyframe_distance;
+    std::string _registration;
+    unsigned    _submap_fragments;
+    float       _submap_radius;
+    float       _map_resolution;
+    unsigned    _loop_closures;
+    bool        _pyramid;
+    bool        _coarse_alignment;
+    unsigned    _jobs;
+    double      _memory_limit_gb;
 };
 
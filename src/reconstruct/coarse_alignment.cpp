@@ -0,0 +1,285 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <pcl/features/fpfh_omp.h>
+#include <pcl/kdtree/kdtree_flann.h>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+#else
+#include <eigen3/Eigen/Dense>
+#include <eigen3/Eigen/Geometry>
+#endif
+
+#include "coarse_alignment.h"
+
+// Bits per axis in a keypoint voxel key, the voxel coordinates are stored with an offset
+constexpr int key_bits = 21;
+constexpr std::int64_t key_offset = std::int64_t(1) << (key_bits - 1);
+constexpr std::uint64_t key_mask = (std::uint64_t(1) << key_bits) - 1;
+
+// Edges of a sampled triplet must agree within this fraction in both clouds and be at least this
+// many keypoint voxels long, shorter triplets barely constrain the rotation
+constexpr float edge_similarity = 0.1f;
+constexpr float min_edge_voxels = 2.0f;
+
+// Fewest inliers of an accepted transformation
+constexpr std::size_t min_inliers = 10;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static std::uint64_t
+voxel_key(const Eigen::Vector3f &point, float size, Eigen::Vector3f &centre)
+{
+    const Eigen::Vector3f voxel = (point / size).array().floor();
+    centre = (voxel.array() + 0.5f) * size;
+    return  (static_cast<std::uint64_t>(static_cast<std::int64_t>(voxel.x()) + key_offset) & key_mask)
+         | ((static_cast<std::uint64_t>(static_cast<std::int64_t>(voxel.y()) + key_offset) & key_mask) << key_bits)
+         | ((static_cast<std::uint64_t>(static_cast<std::int64_t>(voxel.z()) + key_offset) & key_mask) << (2 * key_bits));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+CoarseAlignment::Features::Features()
+    : descriptors(new pcl::PointCloud<pcl::FPFHSignature33>)
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+CoarseAlignment::CoarseAlignment()
+    : keypoint_voxel_size_{0.3f},
+      descriptor_voxel_size_{0.1f},
+      feature_radius_{0.5f},
+      inlier_distance_{0.3f},
+      maximum_iterations_{100000},
+      confidence_{0.999},
+      gravity_constrained_{false},
+      transformation_(Eigen::Matrix4f::Identity()),
+      inliers_{0},
+      iterations_{0}
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+CoarseAlignment::describe(PreparedCloud &cloud, Features &features) const
+{
+    PreparedCloud &level = cloud.level(descriptor_voxel_size_);
+    const PreparedCloud::cloud_t &points = *level.cloud();
+
+    // The point closest to the centre of every keypoint voxel
+    std::unordered_map<std::uint64_t, std::pair<int, float> > closest;
+    for (std::size_t i = 0; i < points.size(); ++i) {
+        Eigen::Vector3f centre;
+        const std::uint64_t key = voxel_key(points.points[i].getVector3fMap(), keypoint_voxel_size_, centre);
+        const float distance = (points.points[i].getVector3fMap() - centre).squaredNorm();
+        auto inserted = closest.insert(std::make_pair(key, std::make_pair(static_cast<int>(i), distance)));
+        if (!inserted.second && distance < inserted.first->second.second) {
+            inserted.first->second = std::make_pair(static_cast<int>(i), distance);
+        }
+    }
+    pcl::IndicesPtr indices(new std::vector<int>);
+    indices->reserve(closest.size());
+    for (const auto &voxel : closest) {
+        indices->push_back(voxel.second.first);
+    }
+    std::sort(indices->begin(), indices->end());
+
+    pcl::PointCloud<pcl::FPFHSignature33> all;
+    pcl::FPFHEstimationOMP<pcl::PointNormal, pcl::PointNormal, pcl::FPFHSignature33> fpfh;
+    fpfh.setInputCloud(level.cloud());
+    fpfh.setInputNormals(level.cloud());
+    fpfh.setIndices(indices);
+    fpfh.setSearchMethod(level.search());
+    fpfh.setRadiusSearch(feature_radius_);
+    fpfh.compute(all);
+
+    // Keypoints without neighbours get NaN histograms
+    features.keypoints.clear();
+    features.descriptors->clear();
+    for (std::size_t k = 0; k < all.size() && k < indices->size(); ++k) {
+        if (std::isfinite(all.points[k].histogram[0])) {
+            features.keypoints.push_back(points.points[(*indices)[k]].getVector3fMap());
+            features.descriptors->push_back(all.points[k]);
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+Eigen::Matrix4f
+CoarseAlignment::fit(const std::vector<int> &matches) const
+{
+    const int n = static_cast<int>(matches.size());
+    Eigen::Matrix3Xf source(3, n);
+    Eigen::Matrix3Xf target(3, n);
+    for (int k = 0; k < n; ++k) {
+        source.col(k) = source_points_[matches[k]];
+        target.col(k) = target_points_[matches[k]];
+    }
+    if (!gravity_constrained_) {
+        return Eigen::umeyama(source, target, false);
+    }
+
+    // The yaw that best aligns the centred points in the horizontal plane
+    const Eigen::Vector3f source_mean = source.rowwise().mean();
+    const Eigen::Vector3f target_mean = target.rowwise().mean();
+    double sine = 0;
+    double cosine = 0;
+    for (int k = 0; k < n; ++k) {
+        const Eigen::Vector3f s = source.col(k) - source_mean;
+        const Eigen::Vector3f t = target.col(k) - target_mean;
+        sine += s.x() * t.y() - s.y() * t.x();
+        cosine += s.x() * t.x() + s.y() * t.y();
+    }
+    Eigen::Matrix4f transformation = Eigen::Matrix4f::Identity();
+    transformation.topLeftCorner<3, 3>() = Eigen::AngleAxisf(static_cast<float>(std::atan2(sine, cosine)),
+                                                             Eigen::Vector3f::UnitZ()).toRotationMatrix();
+    transformation.col(3).head<3>() = target_mean - transformation.topLeftCorner<3, 3>() * source_mean;
+    return transformation;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+std::size_t
+CoarseAlignment::count_inliers(const Eigen::Matrix4f &transformation, std::vector<int> *inliers) const
+{
+    const Eigen::Matrix3f rotation = transformation.topLeftCorner<3, 3>();
+    const Eigen::Vector3f translation = transformation.col(3).head<3>();
+    const float max_distance = std::max(inlier_distance_, keypoint_voxel_size_);
+    const float max_distance_squared = max_distance * max_distance;
+    std::size_t count = 0;
+    for (std::size_t k = 0; k < source_points_.size(); ++k) {
+        if ((rotation * source_points_[k] + translation - target_points_[k]).squaredNorm() <= max_distance_squared) {
+            ++count;
+            if (inliers) {
+                inliers->push_back(static_cast<int>(k));
+            }
+        }
+    }
+    return count;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool
+CoarseAlignment::align(const Features &target, const Features &source, const Eigen::Matrix4f &guess)
+{
+    transformation_ = guess;
+    inliers_ = 0;
+    iterations_ = 0;
+    source_points_.clear();
+    target_points_.clear();
+
+    const pcl::PointCloud<pcl::FPFHSignature33>::Ptr &target_descriptors = target.descriptors;
+    const pcl::PointCloud<pcl::FPFHSignature33>::Ptr &source_descriptors = source.descriptors;
+    if (target_descriptors->size() < 3 || source_descriptors->size() < 3) {
+        return false;
+    }
+
+    // Nearest descriptors in both directions
+    pcl::KdTreeFLANN<pcl::FPFHSignature33> target_index;
+    pcl::KdTreeFLANN<pcl::FPFHSignature33> source_index;
+    target_index.setInputCloud(target_descriptors);
+    source_index.setInputCloud(source_descriptors);
+    const long source_size = static_cast<long>(source_descriptors->size());
+    const long target_size = static_cast<long>(target_descriptors->size());
+    std::vector<int> forward(source_size, -1);
+    std::vector<int> backward(target_size, -1);
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+        std::vector<int> index(1);
+        std::vector<float> distance_squared(1);
+#ifdef _OPENMP
+#pragma omp for schedule(static) nowait
+#endif
+        for (long i = 0; i < source_size; ++i) {
+            if (target_index.nearestKSearch(source_descriptors->points[i], 1, index, distance_squared) > 0) {
+                forward[i] = index[0];
+            }
+        }
+#ifdef _OPENMP
+#pragma omp for schedule(static) nowait
+#endif
+        for (long j = 0; j < target_size; ++j) {
+            if (source_index.nearestKSearch(target_descriptors->points[j], 1, index, distance_squared) > 0) {
+                backward[j] = index[0];
+            }
+        }
+    }
+
+    // Mutual nearest neighbours
+    for (long i = 0; i < source_size; ++i) {
+        if (forward[i] >= 0 && backward[forward[i]] == i) {
+            source_points_.push_back(source.keypoints[i]);
+            target_points_.push_back(target.keypoints[forward[i]]);
+        }
+    }
+    const int matches = static_cast<int>(source_points_.size());
+    const std::size_t guess_inliers = count_inliers(guess);
+    inliers_ = guess_inliers;
+    if (matches < 3) {
+        return false;
+    }
+
+    // RANSAC on triplets with consistent edge lengths, deterministic for a given set of matches
+    std::mt19937 random(matches);
+    std::uniform_int_distribution<int> pick(0, matches - 1);
+    const float min_edge = min_edge_voxels * keypoint_voxel_size_;
+    std::vector<int> sample(3);
+    std::size_t best_inliers = 0;
+    Eigen::Matrix4f best = Eigen::Matrix4f::Identity();
+    int required = maximum_iterations_;
+    for (; iterations_ < required; ++iterations_) {
+        sample[0] = pick(random);
+        sample[1] = pick(random);
+        sample[2] = pick(random);
+        if (sample[0] == sample[1] || sample[0] == sample[2] || sample[1] == sample[2]) {
+            continue;
+        }
+        bool consistent = true;
+        for (int a = 0; a < 3 && consistent; ++a) {
+            const int b = (a + 1) % 3;
+            const float source_edge = (source_points_[sample[a]] - source_points_[sample[b]]).norm();
+            const float target_edge = (target_points_[sample[a]] - target_points_[sample[b]]).norm();
+            consistent = std::min(source_edge, target_edge) >= min_edge
+                      && std::abs(source_edge - target_edge) <= edge_similarity * std::max(source_edge, target_edge);
+        }
+        if (!consistent) {
+            continue;
+        }
+
+        const Eigen::Matrix4f transformation = fit(sample);
+        const std::size_t inliers = count_inliers(transformation);
+        if (inliers > best_inliers) {
+            best_inliers = inliers;
+            best = transformation;
+
+            // Iterations until a sample of three inliers was drawn with the confidence
+            const double all_inliers = std::pow(static_cast<double>(inliers) / matches, 3);
+            const double needed = all_inliers >= 1 ? 1 : std::ceil(std::log(1 - confidence_) / std::log(1 - all_inliers));
+            required = static_cast<int>(std::min<double>(needed, maximum_iterations_));
+        }
+    }
+    if (best_inliers < 3) {
+        return false;
+    }
+
+    // Refit to all inliers of the best sample
+    std::vector<int> inliers;
+    count_inliers(best, &inliers);
+    const Eigen::Matrix4f refined = fit(inliers);
+    const std::size_t refined_inliers = count_inliers(refined);
+    if (refined_inliers >= best_inliers) {
+        best = refined;
+        best_inliers = refined_inliers;
+    }
+    if (best_inliers < min_inliers || best_inliers <= guess_inliers) {
+        return false;
+    }
+    transformation_ = best;
+    inliers_ = best_inliers;
+    return true;
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+#include "prepared_cloud.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Global alignment of two clouds with normals that does not depend on an initial guess, so ICP can
+// start near the solution when the odometry is wrong. Both clouds are downsampled to
+// descriptor_voxel_size, the point closest to the centre of every keypoint_voxel_size voxel is a
+// keypoint and gets an FPFH descriptor, computed on all OpenMP threads. Keypoints whose descriptors
+// are mutual nearest neighbours are matches, and RANSAC fits rigid transformations to triplets of
+// matches whose edge lengths agree in both clouds. RANSAC stops after as many iterations as the
+// best inlier ratio so far requires for the confidence. A match is an inlier within the inlier
+// distance, which is at least the keypoint voxel size because the keypoints of the two clouds are
+// picked independently within their voxels.
+class CoarseAlignment
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    typedef std::vector<Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f> > points_t;
+
+    // Keypoints of a cloud and their descriptors. The descriptors do not change with rigid motions,
+    // so the features of a cloud can be computed once in its own frame and aligned several times.
+    struct Features
+    {
+        Features();
+
+        points_t keypoints;
+        pcl::PointCloud<pcl::FPFHSignature33>::Ptr descriptors;
+    };
+
+    CoarseAlignment();
+
+    void setKeypointVoxelSize(float size) { keypoint_voxel_size_ = size; }
+    void setDescriptorVoxelSize(float size) { descriptor_voxel_size_ = size; }
+    void setFeatureRadius(float radius) { feature_radius_ = radius; }
+    void setInlierDistance(float distance) { inlier_distance_ = distance; }
+    void setMaximumIterations(int iterations) { maximum_iterations_ = iterations; }
+    void setConfidence(double confidence) { confidence_ = confidence; }
+
+    // Fits rotations about z only, for clouds leveled with gravity
+    void setGravityConstrained(bool constrained) { gravity_constrained_ = constrained; }
+
+    // Features of a cloud with normals, in its frame. Pass the full cloud, it is downsampled here.
+    void
+    describe(PreparedCloud &cloud, Features &features) const;
+
+    // Estimates the transformation of the source features onto the target features. Returns whether
+    // it is accepted: it needs enough inliers and must explain more matches than `guess`. Otherwise
+    // the final transformation is the guess.
+    bool
+    align(const Features &target, const Features &source, const Eigen::Matrix4f &guess = Eigen::Matrix4f::Identity());
+
+    Eigen::Matrix4f getFinalTransformation() const { return transformation_; }
+    std::size_t     getMatches() const { return source_points_.size(); }
+    std::size_t     getInliers() const { return inliers_; }
+    int             getIterations() const { return iterations_; }
+
+private:
+    // Rigid transformation of the source points of the matches onto their target points
+    Eigen::Matrix4f
+    fit(const std::vector<int> &matches) const;
+
+    // Matches whose source point is moved within the inlier distance of its target point
+    std::size_t
+    count_inliers(const Eigen::Matrix4f &transformation, std::vector<int> *inliers = nullptr) const;
+
+    float keypoint_voxel_size_;
+    float descriptor_voxel_size_;
+    float feature_radius_;
+    float inlier_distance_;
+    int maximum_iterations_;
+    double confidence_;
+    bool gravity_constrained_;
+
+    // Matched keypoints
+    points_t source_points_;
+    points_t target_points_;
+
+    Eigen::Matrix4f transformation_;
+    std::size_t inliers_;
+    int iterations_;
+};
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1,96 +1,271 @@
+// PointXYZLT is a custom point type, instantiate PCL templates from their headers
+#define PCL_NO_PRECOMPILE
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include <pcl/point_cloud.h>
 #include <pcl/io/pcd_io.h>
-#include <pcl/common/transforms.h>
 #include <pcl/visualization/pcl_visualizer.h>
 
 #include <boost/filesystem.hpp>
 
+#include "pose_trajectory.h"
+#include "range_image.h"
+#include "reco_types.h"
+#include "scan_stream.h"
 #include "transformation.h"
+#include "transform_kernel.h"
+
+typedef std::vector<pcl::PointCloud<PointXYZLT> > datapackets_t;
+
+// Firing sequences of the VLP-16 are 55.296 us apart and the 16 lasers of a sequence fire 2.304 us
+// after each other. When de-skewing, the returns of one firing sequence share one orientation, so a
+// datapacket is transformed in 24 blocks instead of point by point.
+static constexpr double deskew_block_time = 55.296;
+static constexpr double laser_firing_time = 2.304;
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-std::vector<std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d>>>
-quaternions_scan_assignment(const std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > &quaternions,
-                            std::vector<std::vector<pcl::PointCloud<pcl::PointXYZL> > > &datapacket_clouds)
+// Start of the firing sequence of a return relative to the datapacket timestamp. The firing times
+// are truncated to whole microseconds, so the start is off by up to 1 us; the laser follows from
+// its vertical angle in the label (-15, 1, -13, 3, ... in firing order).
+static double
+firing_sequence_start(const PointXYZLT &point)
 {
-    int number, current_number = 0, last_number = 0;
-    std::vector<std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > > quaternions_scans;
-    std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > quaternions_data_packets;
+    const std::int32_t vertical = static_cast<std::int32_t>(point.label);
+    const int laser = vertical < 0 ? vertical + 15 : vertical;
+    return point.time - laser_firing_time * std::min(std::max(laser, 0), 15);
+}
 
-    // Assign the qauternions to the respective datapackets and scans
-    for (std::size_t i = 0; i < datapacket_clouds.size(); ++i) {
-        number = (int) datapacket_clouds[i].size();
-        current_number += number;
-        for (int j = last_number; j < current_number; ++j) {
-            quaternions_data_packets.push_back(quaternions[j]);
+static constexpr std::size_t stride = sizeof(PointXYZLT) / sizeof(float);
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Transforms the returns of one datapacket with the orientation at their own firing time
+void
+transform_datapacket_deskewed(const pcl::PointCloud<PointXYZLT> &datapacket,
+                              const double datapacket_time,
+                              const PoseTrajectory &trajectory,
+                              PointXYZLT *output)
+{
+    // Firing index of every return relative to the first one, rounded so the truncation of the
+    // firing times cannot split or merge a sequence. Captures without firing times have time 0
+    // everywhere and form one block.
+    std::vector<std::size_t> block_starts;
+    std::vector<double> block_times;
+    const bool timed = !datapacket.empty() && datapacket.points.front().time != datapacket.points.back().time;
+    const double first_start = timed ? firing_sequence_start(datapacket.points[0]) : 0;
+    long block = 0;
+    for (std::size_t k = 0; k < datapacket.size(); ++k) {
+        const long firing = timed ? std::lround((firing_sequence_start(datapacket.points[k]) - first_start) / deskew_block_time) : 0;
+        if (block_starts.empty() || firing != block) {
+            block = firing;
+            block_starts.push_back(k);
+            block_times.push_back(datapacket_time + first_start + firing * deskew_block_time);
         }
-        quaternions_scans.push_back(quaternions_data_packets);
-        last_number += number;
-        quaternions_data_packets.clear();
     }
-    return quaternions_scans;
+    block_starts.push_back(datapacket.size());
+
+    vector4d_t quaternions;
+    trajectory.at(block_times, quaternions);
+    for (std::size_t b = 0; b < block_times.size(); ++b) {
+        float matrix[12];
+        make_transformation_matrix(quaternions[b], matrix);
+        transform_points(datapacket.points[block_starts[b]].data, output[block_starts[b]].data,
+                         block_starts[b + 1] - block_starts[b], stride, matrix);
+    }
 }
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Transforms every datapacket with the orientation at its timestamp and writes it directly to its
+// final position in the combined cloud. The output is sized once from the packet sizes, so the
+// packets are independent and are processed in parallel.
 void
-combine_datapackets_to_scans(std::vector<std::vector<pcl::PointCloud<pcl::PointXYZL> > > datapacket_clouds,
-                             const std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > &quaternions,
-                             const std::string path)
+transform_datapackets(const std::vector<const pcl::PointCloud<PointXYZLT> *> &datapackets,
+                      const PoseTrajectory &trajectory,
+                      const double *datapacket_times,
+                      const bool deskew,
+                      pcl::PointCloud<PointXYZLT> &combined)
 {
-    const std::vector<std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > >
-        quaternions_scans = quaternions_scan_assignment(quaternions, datapacket_clouds);
-    std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d> > transformation_matrices;
-    boost::filesystem::create_directory(path + "/scans");
+    const std::vector<double> times(datapacket_times, datapacket_times + datapackets.size());
+    vector4d_t quaternions;
+    trajectory.at(times, quaternions);
+
+    std::vector<std::size_t> offsets(datapackets.size() + 1, 0);
+    for (std::size_t j = 0; j < datapackets.size(); ++j) {
+        offsets[j + 1] = offsets[j] + datapackets[j]->size();
+    }
+    combined.resize(offsets.back());
+    combined.width    = static_cast<std::uint32_t>(offsets.back());
+    combined.height   = 1;
+    combined.is_dense = false;
+
+    const long packets = static_cast<long>(datapackets.size());
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (long j = 0; j < packets; ++j) {
+        const pcl::PointCloud<PointXYZLT> &packet = *datapackets[j];
+        if (packet.empty()) {
+            continue;
+        }
+        if (deskew) {
+            transform_datapacket_deskewed(packet, datapacket_times[j], trajectory, &combined.points[offsets[j]]);
+            continue;
+        }
+        float matrix[12];
+        make_transformation_matrix(quaternions[j], matrix);
+        transform_points(packet.points[0].data, combined.points[offsets[j]].data, packet.size(), stride, matrix);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// There is one timestamp per datapacket, in the order of the scans and of the packets within a scan.
+std::size_t
+number_of_datapackets(const std::vector<datapackets_t> &datapacket_clouds,
+                      const std::size_t number_of_times)
+{
+    std::size_t packets = 0;
     for (std::size_t i = 0; i < datapacket_clouds.size(); ++i) {
-        // Make transformation matrices from quaternions
-        std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d> > transformation_matrices = make_transformation_matrices(quaternions_scans[i]);
-        pcl::PointCloud<pcl::PointXYZL>::Ptr datapackets_combined(new pcl::PointCloud<pcl::PointXYZL>);
-        for (std::size_t j = 0; j < datapacket_clouds[i].size(); ++j) {
-            pcl::transformPointCloud(datapacket_clouds[i][j], datapacket_clouds[i][j], transformation_matrices[j]);
-            *datapackets_combined += datapacket_clouds[i][j];
+        packets += datapacket_clouds[i].size();
+    }
+    if (packets > number_of_times) {
+        std::cerr << "Found " << packets << " datapackets but only " << number_of_times
+                  << " timestamps. The remaining datapackets are ignored." << std::endl;
+    }
+    return std::min(packets, number_of_times);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+combine_datapackets_to_scans(const std::vector<datapackets_t> &datapacket_clouds,
+                             const PoseTrajectory &trajectory,
+                             const std::vector<double> &datapacket_times,
+                             const imu_vector_t &imu,
+                             const bool deskew,
+                             KeyframeSelector &scans,
+                             const std::string save_path)
+{
+    const std::size_t packets = number_of_datapackets(datapacket_clouds, datapacket_times.size());
+    std::unique_ptr<AsyncScanWriter> writer;
+    if (!save_path.empty()) {
+        writer.reset(new AsyncScanWriter(save_path + "/scans"));
+    }
+    const bool preintegrate = imu.size() >= packets;
+    if (!imu.empty() && !preintegrate) {
+        std::cerr << "imu_data.csv has " << imu.size() << " samples for " << packets
+                  << " datapackets, the IMU motion is not preintegrated." << std::endl;
+    }
+    std::size_t previous_middle = 0;
+    std::size_t first_packet = 0;
+    for (std::size_t i = 0; i < datapacket_clouds.size() && first_packet < packets; ++i) {
+        std::vector<const pcl::PointCloud<PointXYZLT> *> scan_datapackets;
+        for (std::size_t j = 0; j < datapacket_clouds[i].size() && first_packet + j < packets; ++j) {
+            scan_datapackets.push_back(&datapacket_clouds[i][j]);
+        }
+        pcl::PointCloud<PointXYZLT> datapackets_combined;
+        transform_datapackets(scan_datapackets, trajectory, &datapacket_times[first_packet], deskew, datapackets_combined);
+
+        // Pose of the sensor in the middle of the scan, for projecting into the range image
+        const std::size_t middle = first_packet + scan_datapackets.size() / 2;
+        float matrix[12];
+        make_transformation_matrix(trajectory.at(datapacket_times[middle]), matrix);
+        Eigen::Matrix4f sensor_pose = Eigen::Matrix4f::Identity();
+        for (int r = 0; r < 3; ++r) {
+            for (int c = 0; c < 4; ++c) {
+                sensor_pose(r, c) = matrix[4 * r + c];
+            }
+        }
+        first_packet += scan_datapackets.size();
+
+        // Hand the scan over to the registration
+        scan_t::Ptr scan(new scan_t);
+        scan->resize(datapackets_combined.size());
+        for (std::size_t k = 0; k < datapackets_combined.size(); ++k) {
+            scan->points[k].getVector4fMap() = datapackets_combined.points[k].getVector4fMap();
+        }
+
+        // The image is placed by the returns in the sensor frame, which are in the same order
+        RangeImage::Ptr image(new RangeImage);
+        image->set_sensor_pose(sensor_pose);
+        std::size_t k = 0;
+        for (std::size_t j = 0; j < scan_datapackets.size(); ++j) {
+            for (std::size_t p = 0; p < scan_datapackets[j]->size(); ++p, ++k) {
+                image->insert(scan_datapackets[j]->points[p], scan->points[k].getVector3fMap(), static_cast<std::int32_t>(k));
+            }
+        }
+        image->remove_outliers();
+        if (image->size() == 0) {
+            image.reset();
         }
-        // Save scan
-        pcl::PointCloud<pcl::PointNormal>::Ptr scan(new pcl::PointCloud<pcl::PointNormal>);
-        pcl::copyPointCloud(*datapackets_combined, *scan);
-        pcl::io::savePCDFileBinary(path + "/scans/scan_" + std::to_string(i) + ".pcd", *scan);
-        transformation_matrices.clear();
+
+        // IMU motion between the middles of the previous and this scan, times are in microseconds
+        std::shared_ptr<ImuPreintegration> motion;
+        if (preintegrate && i > 0) {
+            motion.reset(new ImuPreintegration);
+            for (std::size_t j = previous_middle; j < middle; ++j) {
+                Eigen::Matrix3d orientation;
+                make_rotation_matrix_from_quaternion(trajectory.at(datapacket_times[j]), orientation);
+                motion->integrate(imu[j], orientation, (datapacket_times[j + 1] - datapacket_times[j]) * 1e-6);
+            }
+        }
+        previous_middle = middle;
+
+        if (writer) {
+            writer->write(static_cast<int>(i), scan);
+        }
+        scans.push(Scan{scan, image, motion});
     }
+    scans.close();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void
-combine_datapackets_to_fragment(std::vector<std::vector<pcl::PointCloud<pcl::PointXYZL> > > datapacket_clouds,
-                                const std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > &quaternions,
-                                const std::string path)
+combine_datapackets_to_fragment(const std::vector<datapackets_t> &datapacket_clouds,
+                                const PoseTrajectory &trajectory,
+                                const std::vector<double> &datapacket_times,
+                                const bool deskew,
+                                const std::string path,
+                                const Eigen::Matrix3f &leveling)
 {
-    const std::vector<std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d>>>
-        quaternions_scans = quaternions_scan_assignment(quaternions, datapacket_clouds);
-    pcl::PointCloud<pcl::PointXYZL>::Ptr datapackets_combined(new pcl::PointCloud<pcl::PointXYZL>);
-    std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d> > transformation_matrices;
+    const std::size_t packets = number_of_datapackets(datapacket_clouds, datapacket_times.size());
+    std::vector<const pcl::PointCloud<PointXYZLT> *> fragment_datapackets;
+    fragment_datapackets.reserve(packets);
     for (std::size_t i = 0; i < datapacket_clouds.size(); ++i) {
-        // Make transformation matrices from quaternions
-        std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d> > transformation_matrices = make_transformation_matrices(quaternions_scans[i]);
-        for (std::size_t j = 0; j < datapacket_clouds[i].size(); ++j) {
-            pcl::transformPointCloud(datapacket_clouds[i][j], datapacket_clouds[i][j], transformation_matrices[j]);
-            *datapackets_combined += datapacket_clouds[i][j];
+        for (std::size_t j = 0; j < datapacket_clouds[i].size() && fragment_datapackets.size() < packets; ++j) {
+            fragment_datapackets.push_back(&datapacket_clouds[i][j]);
+        }
+    }
+    pcl::PointCloud<PointXYZLT>::Ptr datapackets_combined(new pcl::PointCloud<PointXYZLT>);
+    transform_datapackets(fragment_datapackets, trajectory, datapacket_times.data(), deskew, *datapackets_combined);
+    if (!leveling.isIdentity()) {
+        for (std::size_t i = 0; i < datapackets_combined->size(); ++i) {
+            datapackets_combined->points[i].getVector3fMap() = leveling * datapackets_combined->points[i].getVector3fMap();
         }
-        transformation_matrices.clear();
     }
+
     // Save fragment
     pcl::io::savePCDFileBinary(path + "/fragment.pcd", *datapackets_combined);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+visualize_fragment(const std::string path)
+{
+    pcl::PointCloud<PointXYZLT>::Ptr fragment(new pcl::PointCloud<PointXYZLT>);
+    pcl::io::loadPCDFile<PointXYZLT>(path + "/fragment.pcd", *fragment);
 
-    // Visualize fragment
     pcl::visualization::PCLVisualizer viz;
     viz.setBackgroundColor(255, 255, 255);
-    pcl::visualization::PointCloudColorHandlerCustom<pcl::PointXYZL> cloud_color(datapackets_combined, 0, 255, 0);
-    viz.addPointCloud<pcl::PointXYZL>(datapackets_combined, cloud_color, "cloud 1");
+    pcl::visualization::PointCloudColorHandlerCustom<PointXYZLT> cloud_color(fragment, 0, 255, 0);
+    viz.addPointCloud<PointXYZLT>(fragment, cloud_color, "cloud 1");
     viz.setPointCloudRenderingProperties(pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 0.5, "cloud 1");
     while (!viz.wasStopped ())
     {
         viz.spinOnce ();
     }
 }
-//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////
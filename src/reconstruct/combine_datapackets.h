@@ -4,14 +4,34 @@
 #include <vector>
 #include <pcl/point_cloud.h>
 
+#include "pose_trajectory.h"
+#include "reco_types.h"
+#include "scan_stream.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Pushes every scan to `scans` as soon as it is combined and closes it after the last one.
+// If save_path is not empty, the scans are also written to save_path/scans in the background. With
+// one IMU sample per datapacket in `imu` every scan carries the preintegrated motion since the
+// previous one.
+void
+combine_datapackets_to_scans(const std::vector<std::vector<pcl::PointCloud<PointXYZLT> > > &datapacket_clouds,
+                             const PoseTrajectory &trajectory,
+                             const std::vector<double> &datapacket_times,
+                             const imu_vector_t &imu,
+                             const bool deskew,
+                             KeyframeSelector &scans,
+                             const std::string save_path);
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Writes path/fragment.pcd, rotated with leveling
 void
-combine_datapackets_to_scans(std::vector<std::vector<pcl::PointCloud<pcl::PointXYZL> > > datapacket_clouds,
-                             const std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > &quaternions,
-                             const std::string path);
+combine_datapackets_to_fragment(const std::vector<std::vector<pcl::PointCloud<PointXYZLT> > > &datapacket_clouds,
+                                const PoseTrajectory &trajectory,
+                                const std::vector<double> &datapacket_times,
+                                const bool deskew,
+                                const std::string path,
+                                const Eigen::Matrix3f &leveling = Eigen::Matrix3f::Identity());
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Shows path/fragment.pcd and blocks until the window is closed. Must be called from the main thread.
 void
-combine_datapackets_to_fragment(std::vector<std::vector<pcl::PointCloud<pcl::PointXYZL> > > datapacket_clouds,
-                                const std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > &quaternions,
-                                const std::string path);
+visualize_fragment(const std::string path);
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
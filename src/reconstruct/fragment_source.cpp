@@ -0,0 +1,63 @@
+#include <cstddef>
+#include <future>
+#include <string>
+
+#include <pcl/io/pcd_io.h>
+
+#include <boost/filesystem.hpp>
+
+#include "fragment_source.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+FragmentSource::FragmentSource(const std::string fragments_path, const int fragments_number)
+    : fragments_path_{fragments_path},
+      fragments_number_{fragments_number},
+      prefetch_index_{-1}
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+FragmentSource::~FragmentSource()
+{
+    if (prefetch_.valid()) {
+        prefetch_.wait();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+FragmentSource::fragment_t::Ptr
+FragmentSource::load(const int i) const
+{
+    fragment_t::Ptr cloud(new fragment_t);
+    pcl::io::loadPCDFile<pcl::PointXYZ>(fragments_path_ + "/fragment_" + std::to_string(i) + "/fragment.pcd", *cloud);
+    return cloud;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+std::size_t
+FragmentSource::file_size(const int i) const
+{
+    return boost::filesystem::file_size(fragments_path_ + "/fragment_" + std::to_string(i) + "/fragment.pcd");
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+FragmentSource::fragment_t::Ptr
+FragmentSource::get(const int i, const bool prefetch_next)
+{
+    fragment_t::Ptr cloud;
+    if (prefetch_.valid() && prefetch_index_ == i) {
+        cloud = prefetch_.get();
+    } else {
+        if (prefetch_.valid()) {
+            prefetch_.wait();
+            prefetch_ = std::future<fragment_t::Ptr>();
+        }
+        cloud = load(i);
+    }
+
+    if (prefetch_next && i + 1 < fragments_number_) {
+        prefetch_index_ = i + 1;
+        prefetch_ = std::async(std::launch::async, &FragmentSource::load, this, i + 1);
+    }
+    return cloud;
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <future>
+#include <string>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Loads fragment_<i>/fragment.pcd on demand instead of keeping all fragments in memory. While the
+// caller works on fragment i, fragment i + 1 is loaded on a background thread. The source keeps no
+// reference to a fragment once it was handed out, so its memory is released as soon as the caller
+// drops it.
+class FragmentSource
+{
+public:
+    typedef pcl::PointCloud<pcl::PointXYZ> fragment_t;
+
+    FragmentSource(const std::string fragments_path, const int fragments_number);
+    ~FragmentSource();
+
+    FragmentSource(const FragmentSource &) = delete;
+    FragmentSource &operator=(const FragmentSource &) = delete;
+
+    int size() const { return fragments_number_; }
+
+    // Fragment i, and starts prefetching fragment i + 1 unless prefetch_next is false, e.g. because
+    // fragment i + 1 has not been written yet
+    fragment_t::Ptr
+    get(const int i, const bool prefetch_next = true);
+
+    // Loads fragment i without prefetching, safe to call from several threads
+    fragment_t::Ptr
+    load(const int i) const;
+
+    // Size of the file of fragment i in bytes
+    std::size_t
+    file_size(const int i) const;
+
+private:
+
+    std::string fragments_path_;
+    int fragments_number_;
+    int prefetch_index_;
+    std::future<fragment_t::Ptr> prefetch_;
+};
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,131 @@
+#include <cmath>
+#include <limits>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+#else
+#include <eigen3/Eigen/Dense>
+#include <eigen3/Eigen/Geometry>
+#endif
+
+#include "gauss_newton.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+NormalEquations::NormalEquations()
+    : H(Eigen::Matrix<double, 6, 6>::Zero()),
+      b(Eigen::Matrix<double, 6, 1>::Zero()),
+      squared_error{0},
+      correspondences{0}
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+NormalEquations::add(const Eigen::Matrix<double, 6, 1> &J, double residual, double weight)
+{
+    H.noalias() += weight * J * J.transpose();
+    b.noalias() += weight * residual * J;
+    squared_error += residual * residual;
+    ++correspondences;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+NormalEquations::add(const Eigen::Matrix<double, 3, 6> &J, const Eigen::Vector3d &residual, const Eigen::Matrix3d &information)
+{
+    H.noalias() += J.transpose() * information * J;
+    b.noalias() += J.transpose() * information * residual;
+    squared_error += residual.squaredNorm();
+    ++correspondences;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+NormalEquations &
+NormalEquations::operator+=(const NormalEquations &other)
+{
+    H += other.H;
+    b += other.b;
+    squared_error += other.squared_error;
+    correspondences += other.correspondences;
+    return *this;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+Eigen::Matrix<double, 6, 1>
+NormalEquations::solve() const
+{
+    return H.ldlt().solve(-b);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+apply_left_step(const Eigen::Matrix<double, 6, 1> &delta, Eigen::Matrix4f &transformation)
+{
+    const double angle = delta.tail<3>().norm();
+    Eigen::Matrix4f step = Eigen::Matrix4f::Identity();
+    if (angle > 0) {
+        step.topLeftCorner<3, 3>() = Eigen::AngleAxisd(angle, delta.tail<3>() / angle).toRotationMatrix().cast<float>();
+    }
+    step.col(3).head<3>() = delta.head<3>().cast<float>();
+    transformation = step * transformation;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+add_pose_prior(const Eigen::Matrix4f &transformation,
+               const Eigen::Matrix4f &prior,
+               const Eigen::Matrix<double, 6, 6> &information,
+               Eigen::Matrix<double, 6, 6> &H,
+               Eigen::Matrix<double, 6, 1> &b)
+{
+    // To first order a left step changes the error by the step itself
+    const Eigen::Matrix4d error = transformation.cast<double>() * prior.cast<double>().inverse();
+    const Eigen::AngleAxisd rotation(Eigen::Matrix3d(error.topLeftCorner<3, 3>()));
+    Eigen::Matrix<double, 6, 1> e;
+    e.head<3>() = error.col(3).head<3>();
+    e.tail<3>() = rotation.angle() * rotation.axis();
+    H += information;
+    b += information * e;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+Convergence::Convergence(double transformation_epsilon, double fitness_epsilon)
+    : transformation_epsilon_{transformation_epsilon},
+      fitness_epsilon_{fitness_epsilon},
+      previous_error_{std::numeric_limits<double>::max()}
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool
+Convergence::converged(const Eigen::Matrix<double, 6, 1> &delta, double error)
+{
+    const bool small_change = std::abs(previous_error_ - error) < fitness_epsilon_;
+    previous_error_ = error;
+    return delta.squaredNorm() < transformation_epsilon_ || small_change;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+PosePrior::PosePrior()
+    : has_prior_{false},
+      prior_(Eigen::Matrix4f::Identity()),
+      prior_information_(Eigen::Matrix<double, 6, 6>::Zero())
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+PosePrior::setPrior(const Eigen::Matrix4f &prior, const Eigen::Matrix<double, 6, 6> &information)
+{
+    has_prior_ = true;
+    prior_ = prior;
+    prior_information_ = information;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+PosePrior::add_prior(const Eigen::Matrix4f &transformation, NormalEquations &system) const
+{
+    if (has_prior_) {
+        add_pose_prior(transformation, prior_, prior_information_, system.H, system.b);
+    }
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
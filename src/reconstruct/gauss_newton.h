@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Gauss-Newton system of a rigid alignment with steps (translation, rotation) applied on the left,
+// summed over the correspondences. Systems of disjoint correspondences add up, so every thread
+// fills its own and the OpenMP reduction `+` declared below merges them once at the end.
+struct NormalEquations
+{
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    NormalEquations();
+
+    // A residual along one direction with Jacobian J, e.g. a point-to-plane distance
+    void
+    add(const Eigen::Matrix<double, 6, 1> &J, double residual, double weight = 1);
+
+    // A residual vector with Jacobian J and the information matrix of the residual
+    void
+    add(const Eigen::Matrix<double, 3, 6> &J, const Eigen::Vector3d &residual, const Eigen::Matrix3d &information);
+
+    NormalEquations &
+    operator+=(const NormalEquations &other);
+
+    // The step that solves the system
+    Eigen::Matrix<double, 6, 1>
+    solve() const;
+
+    Eigen::Matrix<double, 6, 6> H;
+    Eigen::Matrix<double, 6, 1> b;
+
+    // Unweighted sum of the squared residuals and their number
+    double squared_error;
+    std::size_t correspondences;
+};
+
+#ifdef _OPENMP
+#pragma omp declare reduction(+ : NormalEquations : omp_out += omp_in) initializer(omp_priv = NormalEquations())
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Applies a Gauss-Newton step (translation, rotation) on the left of transformation
+void
+apply_left_step(const Eigen::Matrix<double, 6, 1> &delta, Eigen::Matrix4f &transformation);
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Adds a prior on a transformation to a Gauss-Newton system of steps applied on the left, ordered
+// (translation, rotation). Makes the alignment stay close to the prior where the scans do not
+// constrain it, e.g. along a corridor.
+void
+add_pose_prior(const Eigen::Matrix4f &transformation,
+               const Eigen::Matrix4f &prior,
+               const Eigen::Matrix<double, 6, 6> &information,
+               Eigen::Matrix<double, 6, 6> &H,
+               Eigen::Matrix<double, 6, 1> &b);
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Convergence criteria of the PCL registrations for Gauss-Newton iterations: the squared norm of
+// the step is below the transformation epsilon, or the mean squared error changed by less than
+// the fitness epsilon since the previous iteration. The default fitness epsilon disables the latter.
+class Convergence
+{
+public:
+    explicit Convergence(double transformation_epsilon,
+                         double fitness_epsilon = -std::numeric_limits<double>::max());
+
+    // Whether the iteration with step delta and mean squared error `error` converged
+    bool
+    converged(const Eigen::Matrix<double, 6, 1> &delta, double error = 0);
+
+private:
+    double transformation_epsilon_;
+    double fitness_epsilon_;
+    double previous_error_;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Optional prior on the transformation of an alignment, for the Gauss-Newton registrations
+class PosePrior
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    // Keeps the alignment close to `prior` with the weight of its information matrix, ordered
+    // (translation, rotation)
+    void
+    setPrior(const Eigen::Matrix4f &prior, const Eigen::Matrix<double, 6, 6> &information);
+
+    void clearPrior() { has_prior_ = false; }
+
+protected:
+    PosePrior();
+
+    // Adds the prior, if one is set, to the system at transformation
+    void
+    add_prior(const Eigen::Matrix4f &transformation, NormalEquations &system) const;
+
+private:
+    bool has_prior_;
+    Eigen::Matrix4f prior_;
+    Eigen::Matrix<double, 6, 6> prior_information_;
+};
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
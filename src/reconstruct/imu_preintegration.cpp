@@ -0,0 +1,104 @@
+#include <cmath>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+#include "imu_preintegration.h"
+
+// Noise densities of the BNO055 of the IMU Brick 2.0. The linear acceleration also carries the
+// error of the gravity removal, so its density is well above the accelerometer's own.
+constexpr double gyroscope_noise = 2.5e-4;      // rad/s/sqrt(Hz)
+constexpr double acceleration_noise = 0.02;     // m/s^2/sqrt(Hz)
+
+// Error of the recorded orientation relative to the rotation since the start of the interval, and
+// a floor for the error of the fusion itself
+constexpr double orientation_scale_error = 0.01;
+constexpr double orientation_noise = 3.5e-3;    // rad
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static Eigen::Matrix3d
+skew(const Eigen::Vector3d &v)
+{
+    Eigen::Matrix3d m;
+    m <<     0, -v.z(),  v.y(),
+         v.z(),      0, -v.x(),
+        -v.y(),  v.x(),      0;
+    return m;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ImuPreintegration::ImuPreintegration()
+    : duration_{0},
+      delta_velocity_(Eigen::Vector3d::Zero()),
+      delta_position_(Eigen::Vector3d::Zero()),
+      covariance_(Eigen::Matrix<double, 9, 9>::Zero())
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+ImuPreintegration::integrate(const ImuSample &sample, const Eigen::Matrix3d &orientation, double dt)
+{
+    if (!(dt > 0)) {
+        return;
+    }
+    const Eigen::Vector3d acceleration = orientation * sample.linear_acceleration;
+
+    // Error propagation of (rotation, velocity, position): a rotation error tilts the acceleration
+    Eigen::Matrix<double, 9, 9> A = Eigen::Matrix<double, 9, 9>::Identity();
+    A.block<3, 3>(3, 0) = -skew(acceleration) * dt;
+    A.block<3, 3>(6, 0) = -0.5 * skew(acceleration) * dt * dt;
+    A.block<3, 3>(6, 3) = Eigen::Matrix3d::Identity() * dt;
+
+    const double rotation_step = orientation_scale_error * sample.angular_velocity.norm() * dt;
+    const double rotation_variance = gyroscope_noise * gyroscope_noise * dt + rotation_step * rotation_step;
+    const double acceleration_variance = acceleration_noise * acceleration_noise / dt;
+    Eigen::Matrix<double, 9, 9> Q = Eigen::Matrix<double, 9, 9>::Zero();
+    Q.block<3, 3>(0, 0) = rotation_variance * Eigen::Matrix3d::Identity();
+    Q.block<3, 3>(3, 3) = acceleration_variance * dt * dt * Eigen::Matrix3d::Identity();
+    Q.block<3, 3>(6, 6) = acceleration_variance * 0.25 * dt * dt * dt * dt * Eigen::Matrix3d::Identity();
+    covariance_ = A * covariance_ * A.transpose() + Q;
+
+    delta_position_ += delta_velocity_ * dt + 0.5 * acceleration * dt * dt;
+    delta_velocity_ += acceleration * dt;
+    duration_ += dt;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+ImuPreintegration::append(const ImuPreintegration &next)
+{
+    // The velocity error of this interval moves the position over the next one
+    Eigen::Matrix<double, 9, 9> A = Eigen::Matrix<double, 9, 9>::Identity();
+    A.block<3, 3>(6, 3) = Eigen::Matrix3d::Identity() * next.duration_;
+    covariance_ = A * covariance_ * A.transpose() + next.covariance_;
+
+    delta_position_ += delta_velocity_ * next.duration_ + next.delta_position_;
+    delta_velocity_ += next.delta_velocity_;
+    duration_ += next.duration_;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+ImuPreintegration::prior(const Eigen::Vector3d &velocity,
+                         double velocity_sigma,
+                         Eigen::Matrix4f &transformation,
+                         Eigen::Matrix<double, 6, 6> &information) const
+{
+    transformation = Eigen::Matrix4f::Identity();
+    transformation.col(3).head<3>() = -(velocity * duration_ + delta_position_).cast<float>();
+
+    // The translation is negated, so are its cross terms with the rotation
+    Eigen::Matrix<double, 6, 6> covariance;
+    covariance.topLeftCorner<3, 3>() = covariance_.block<3, 3>(6, 6)
+                                     + velocity_sigma * velocity_sigma * duration_ * duration_ * Eigen::Matrix3d::Identity();
+    covariance.topRightCorner<3, 3>() = -covariance_.block<3, 3>(6, 0);
+    covariance.bottomLeftCorner<3, 3>() = -covariance_.block<3, 3>(0, 6);
+    covariance.bottomRightCorner<3, 3>() = covariance_.block<3, 3>(0, 0)
+                                         + orientation_noise * orientation_noise * Eigen::Matrix3d::Identity();
+    information = covariance.ldlt().solve(Eigen::Matrix<double, 6, 6>::Identity());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// IMU reading of one datapacket from imu_data.csv in the IMU frame: angular velocity in rad/s and
+// linear acceleration, with gravity removed by the IMU, in m/s^2
+struct ImuSample
+{
+    Eigen::Vector3d angular_velocity;
+    Eigen::Vector3d linear_acceleration;
+};
+typedef std::vector<ImuSample> imu_vector_t;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Integrates the linear accelerations over an interval into the change of velocity and position in
+// the capture frame, with the recorded orientation of every sample, and propagates the covariance
+// of (rotation, velocity, position). The scans are already rotated with the recorded orientation,
+// so the rotation between them is expected to be the identity; the angular velocity only sets how
+// far that orientation can be trusted.
+class ImuPreintegration
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    typedef std::shared_ptr<const ImuPreintegration> ConstPtr;
+
+    ImuPreintegration();
+
+    // Adds a sample held for dt seconds at `orientation`, the rotation from the IMU frame into the
+    // capture frame
+    void
+    integrate(const ImuSample &sample, const Eigen::Matrix3d &orientation, double dt);
+
+    // Extends the interval with the one that follows it
+    void
+    append(const ImuPreintegration &next);
+
+    double                 duration() const { return duration_; }
+    const Eigen::Vector3d &delta_velocity() const { return delta_velocity_; }
+    const Eigen::Vector3d &delta_position() const { return delta_position_; }
+
+    // Prior on the alignment of the scan at the start of the interval onto the scan at its end,
+    // given the sensor velocity at the start and its standard deviation. A static point moves
+    // against the sensor. The information matrix is ordered (translation, rotation) like the
+    // Registration::information_matrix.
+    void
+    prior(const Eigen::Vector3d &velocity,
+          double velocity_sigma,
+          Eigen::Matrix4f &transformation,
+          Eigen::Matrix<double, 6, 6> &information) const;
+
+private:
+    double duration_;
+    Eigen::Vector3d delta_velocity_;
+    Eigen::Vector3d delta_position_;
+
+    // Covariance of (rotation, velocity, position)
+    Eigen::Matrix<double, 9, 9> covariance_;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
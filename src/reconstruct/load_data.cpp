@@ -1,9 +1,18 @@
+// PointXYZLT is a custom point type, instantiate PCL templates from their headers
+#define PCL_NO_PRECOMPILE
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include <pcl/point_cloud.h>
 #include <pcl/io/pcd_io.h>
+#include <pcl/PCLPointCloud2.h>
 
 #if defined __GNUC__ || defined __APPLE__
 #include <Eigen/Dense>
@@ -17,18 +26,16 @@
 
 using namespace boost::filesystem;
 
-///////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////
 int
-number_of_scans(const std::string data_path)
+number_of_directories(const std::string data_path)
 {
-    constexpr int pos_start_number = 5;
     int number = 0;
     path p(data_path);
     for (auto i = directory_iterator(p); i != directory_iterator(); ++i) {
         std::string file = i->path().filename().string();
         if (file == ".DS_Store") { continue; } // If Apple
-
-        int new_number = std::stoi(file.substr(pos_start_number, file.find("_", pos_start_number) - pos_start_number));
+        int new_number = std::stoi(file.substr(file.find("_") + 1, file.length()));
         if (new_number > number) {
             number = new_number;
         }
@@ -37,70 +44,97 @@ number_of_scans(const std::string data_path)
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////
-int
-number_of_directories(const std::string data_path)
+// Datapackets are stored as scan_<scan>_<packet>.pcd. The directory order is unspecified, but the
+// quaternions file has one row per datapacket in (scan, packet) order, so the files are sorted
+// by their numbers before loading.
+std::vector<std::vector<std::string> >
+datapacket_files(const std::string datapackets_path)
 {
-    int number = 0;
-    path p(data_path);
+    constexpr int pos_scan_number = 5;
+    std::vector<std::pair<std::pair<int, int>, std::string> > files;
+    path p(datapackets_path);
     for (auto i = directory_iterator(p); i != directory_iterator(); ++i) {
         std::string file = i->path().filename().string();
         if (file == ".DS_Store") { continue; } // If Apple
-        int new_number = std::stoi(file.substr(file.find("_") + 1, file.length()));
-        if (new_number > number) {
-            number = new_number;
-        }
+        const std::size_t pos_packet_number = file.find("_", pos_scan_number) + 1;
+        const int scan = std::stoi(file.substr(pos_scan_number, pos_packet_number - 1 - pos_scan_number));
+        const int packet = std::stoi(file.substr(pos_packet_number, file.find(".", pos_packet_number) - pos_packet_number));
+        files.push_back(std::make_pair(std::make_pair(scan, packet), datapackets_path + "/" + file));
     }
-    return number + 1;
-}
+    std::sort(files.begin(), files.end());
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////
-std::vector<pcl::PointCloud<pcl::PointXYZ> >
-load_fragments(const std::string fragments_path, const int fragments_number)
-{
-    // Read clouds
-    std::vector<pcl::PointCloud<pcl::PointXYZ> > clouds;
-    for (int i = 0; i < fragments_number; ++i) {
-        pcl::PointCloud<pcl::PointXYZ> cloud;
-        pcl::io::loadPCDFile<pcl::PointXYZ>(fragments_path + "/fragment_" + std::to_string(i) + "/fragment.pcd", cloud);
-        clouds.push_back(cloud);
+    std::vector<std::vector<std::string> > scans(files.empty() ? 0 : files.back().first.first + 1);
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        scans[files[i].first.first].push_back(files[i].second);
     }
-    return clouds;
+    return scans;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////
-std::vector<pcl::PointCloud<pcl::PointXYZL> >
-load_datapackets_in_one_scan(const int scan_number, const std::string datapackets_path)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool
+has_time_field(const std::string file)
 {
-    constexpr int pos_scan_number = 5;
-    path p(datapackets_path);
-    std::vector<pcl::PointCloud<pcl::PointXYZL> > clouds;
-    for (auto i = directory_iterator(p); i != directory_iterator(); ++i) {
-        std::string file = i->path().filename().string();
-        if (file == ".DS_Store") { continue; } // If Apple
-        std::string scan_file_number = file.substr(pos_scan_number, file.find("_", pos_scan_number) - pos_scan_number);
-        if (scan_number == std::stoi(scan_file_number)) {
-            pcl::PointCloud<pcl::PointXYZL> cloud;
-            pcl::io::loadPCDFile<pcl::PointXYZL>(datapackets_path + "/" + file, cloud);
-            clouds.push_back(cloud);
+    pcl::PCLPointCloud2 header;
+    pcl::PCDReader reader;
+    reader.readHeader(file, header);
+    for (std::size_t i = 0; i < header.fields.size(); ++i) {
+        if (header.fields[i].name == "time") {
+            return true;
         }
     }
-    return clouds;
+    return false;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-std::vector<std::vector<pcl::PointCloud<pcl::PointXYZL>>>
+std::vector<std::vector<pcl::PointCloud<PointXYZLT>>>
 load_datapackets(const std::string path)
 {
-    std::vector<std::vector<pcl::PointCloud<pcl::PointXYZL> > > fragment_clouds;
-    std::vector<pcl::PointCloud<pcl::PointXYZL> > datapackets_scan_clouds;
-    int n_scans = number_of_scans(path);
-    for (int i = 0; i < n_scans; ++i) {
-        datapackets_scan_clouds = load_datapackets_in_one_scan(i, path);
-        fragment_clouds.push_back(datapackets_scan_clouds);
+    const std::vector<std::vector<std::string> > files = datapacket_files(path);
+    std::vector<std::vector<pcl::PointCloud<PointXYZLT> > > fragment_clouds(files.size());
+
+    // Older captures have no firing times, load them without to avoid a warning per file
+    bool with_time = true;
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        if (!files[i].empty()) {
+            with_time = has_time_field(files[i][0]);
+            break;
+        }
+    }
+
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        fragment_clouds[i].resize(files[i].size());
+        for (std::size_t j = 0; j < files[i].size(); ++j) {
+            if (with_time) {
+                pcl::io::loadPCDFile<PointXYZLT>(files[i][j], fragment_clouds[i][j]);
+            } else {
+                pcl::PointCloud<pcl::PointXYZL> cloud;
+                pcl::io::loadPCDFile<pcl::PointXYZL>(files[i][j], cloud);
+                pcl::PointCloud<PointXYZLT> &packet = fragment_clouds[i][j];
+                packet.resize(cloud.size());
+                for (std::size_t k = 0; k < cloud.size(); ++k) {
+                    packet.points[k].getVector4fMap() = cloud.points[k].getVector4fMap();
+                    packet.points[k].label = cloud.points[k].label;
+                    packet.points[k].time = 0.0f;
+                }
+            }
+        }
     }
     return fragment_clouds;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+std::size_t
+datapackets_size(const std::string path)
+{
+    std::size_t bytes = 0;
+    for (auto i = directory_iterator(path); i != directory_iterator(); ++i) {
+        if (is_regular_file(i->path())) {
+            bytes += file_size(i->path());
+        }
+    }
+    return bytes;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void read_quaternions_file(quart_vector_t& quaternions, const std::string path)
 {
@@ -128,6 +162,60 @@ void read_quaternions_file(quart_vector_t& quaternions, const std::string path)
         quaternions.second.push_back(time);
     }
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void read_gravity_file(std::vector<Eigen::Vector3d>& gravity, const std::string path)
+{
+    std::ifstream input(path + "/" + "quaternions_datapacket.csv");
+    const std::string delimiter = ",";
+    std::string line;
+    std::getline(input, line); // Skip header
+    while (std::getline(input, line)) {
+        Eigen::Vector3d g;
+        std::size_t pos = 0;
+        for (int column = 0; column < 7 && (pos = line.find(delimiter)) != std::string::npos; ++column) {
+            if (column >= 4) {
+                g(column - 4) = std::stod(line.substr(0, pos));
+            }
+            line.erase(0, pos + delimiter.length());
+        }
+        gravity.push_back(g);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void read_imu_file(imu_vector_t& imu, const std::string path)
+{
+    std::ifstream input(path + "/" + "imu_data.csv");
+    std::string line;
+    std::getline(input, line); // Skip header
+    for (std::size_t row_number = 1; std::getline(input, line); ++row_number) {
+        std::vector<double> row;
+        std::size_t start = 0;
+        bool parsed = true;
+        try {
+            while (start <= line.size() && row.size() < 6) {
+                const std::size_t end = std::min(line.find(',', start), line.size());
+                row.push_back(std::stod(line.substr(start, end - start)));
+                start = end + 1;
+            }
+        } catch (const std::logic_error &) {
+            parsed = false;
+        }
+        if (!parsed || row.size() < 6) {
+            // The samples are indexed by datapacket, a bad row keeps its place without motion
+            std::cerr << "Could not parse row " << row_number << " of imu_data.csv: \"" << line
+                      << "\". Using a zero sample instead." << std::endl;
+            imu.push_back(ImuSample{Eigen::Vector3d::Zero(), Eigen::Vector3d::Zero()});
+            continue;
+        }
+        // Angular velocity in degrees/s, linear acceleration in m/s^2
+        ImuSample sample;
+        sample.angular_velocity = Eigen::Vector3d(row[0], row[1], row[2]) * (M_PI / 180);
+        sample.linear_acceleration = Eigen::Vector3d(row[3], row[4], row[5]);
+        imu.push_back(sample);
+    }
+}
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
@@ -12,20 +12,28 @@
 #include <eigen3/Eigen/Dense>
 #endif
 
+#include "imu_preintegration.h"
 #include "reco_types.h"
 
 ///////////////////////////////////////////////////////////////////////////////////////////
-int
-number_of_scans(const std::string data_path);
-
 int
 number_of_directories(const std::string data_path);
 
-std::vector<pcl::PointCloud<pcl::PointXYZ> >
-load_fragments(const std::string fragments_path, const int fragments_number);
-
-std::vector<std::vector<pcl::PointCloud<pcl::PointXYZL> > >
+std::vector<std::vector<pcl::PointCloud<PointXYZLT> > >
 load_datapackets(const std::string path);
 
+// Size of all datapacket files in the directory, in bytes
+std::size_t
+datapackets_size(const std::string path);
+
 void read_quaternions_file( quart_vector_t& quaternions, const std::string path);
+
+// Gravity vector of every datapacket (g_x, g_y, g_z in quaternions_datapacket.csv) in the IMU frame
+// of the datapacket, in 1/100 m/s^2
+void read_gravity_file( std::vector<Eigen::Vector3d>& gravity, const std::string path);
+
+// Reads imu_data.csv, one row per datapacket. Empty if the capture has no IMU data. Rows that
+// cannot be parsed are reported and read as zero samples, so the rows after them keep their
+// datapacket.
+void read_imu_file( imu_vector_t& imu, const std::string path);
 ///////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,313 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+#include "loam_features.h"
+
+// Neighbours on each side of a return in the curvature
+constexpr int curvature_half_window = 5;
+
+// Curvature above which a return is an edge (about 140 degrees between the two sides) and below
+// which it is planar (about 170 degrees)
+constexpr float edge_curvature = 0.35f;
+constexpr float plane_curvature = 0.1f;
+
+// A neighbourhood with a change in range of more than this fraction between consecutive returns
+// crosses an occlusion, one spanning more than this many columns per neighbour crosses a gap
+constexpr float occlusion_range_jump = 0.1f;
+constexpr int max_column_step = 3;
+
+// Dense edges per sector as a multiple of the edges, and the spacing of the dense planar points
+// along a ring
+constexpr int dense_edges_factor = 5;
+constexpr float dense_plane_spacing = 0.2f;
+
+// Target features around a source feature fitted with a line or a plane. The dense planar points
+// of one ring are collinear, a plane needs enough of them to reach the next ring.
+constexpr int edge_neighbours = 5;
+constexpr int plane_neighbours = 10;
+
+// Eigenvalue ratios of the fitted neighbourhoods. A line has its largest eigenvalue this many times
+// the second. A plane has its smallest this fraction of the second and its second at least this
+// fraction of the largest, so points along one ring are not taken for a plane.
+constexpr float line_eigenvalue_ratio = 5.0f;
+constexpr float plane_thickness_ratio = 0.01f;
+constexpr float plane_spread_ratio = 0.1f;
+
+// Target features further from the source feature than this are not used in the fit
+constexpr float feature_neighbour_distance = 1.0f;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+extract_features(const RangeImage &image,
+                 ScanFeatures &features,
+                 const int sectors,
+                 const int edges_per_sector,
+                 const int planes_per_sector)
+{
+    features.edges->clear();
+    features.planes->clear();
+    features.dense_edges->clear();
+    features.dense_planes->clear();
+
+    const int half = curvature_half_window;
+    std::vector<Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f> > ring;
+    std::vector<float> range;
+    std::vector<int> column;
+    std::vector<float> curvature;
+    std::vector<char> picked;
+    std::vector<int> order;
+
+    for (int row = 0; row < image.rows(); ++row) {
+        // The returns of the ring in azimuth order
+        ring.clear();
+        range.clear();
+        column.clear();
+        for (int c = 0; c < image.columns(); ++c) {
+            if (image.index(row, c) >= 0) {
+                ring.push_back(image.point(row, c));
+                range.push_back(image.range(row, c));
+                column.push_back(c);
+            }
+        }
+        const int n = static_cast<int>(ring.size());
+        if (n < 2 * half + 1) {
+            continue;
+        }
+
+        // Negative curvature marks returns that cannot be selected
+        curvature.assign(n, -1.0f);
+        picked.assign(n, 0);
+        for (int i = half; i < n - half; ++i) {
+            if (column[i + half] - column[i - half] > 2 * half * max_column_step) {
+                continue;
+            }
+            bool occluded = false;
+            for (int j = i - half + 1; j <= i + half; ++j) {
+                occluded |= std::abs(range[j] - range[j - 1]) > occlusion_range_jump * range[i];
+            }
+            if (occluded) {
+                continue;
+            }
+            Eigen::Vector3f before = Eigen::Vector3f::Zero();
+            Eigen::Vector3f after = Eigen::Vector3f::Zero();
+            for (int j = 1; j <= half; ++j) {
+                before += ring[i - j] - ring[i];
+                after += ring[i + j] - ring[i];
+            }
+            const float before_norm = before.norm();
+            const float after_norm = after.norm();
+            if (before_norm > 0 && after_norm > 0) {
+                curvature[i] = 0.5f * (before / before_norm + after / after_norm).norm();
+            }
+        }
+
+        // Planar returns at least dense_plane_spacing apart
+        int spaced = -1;
+        for (int i = half; i < n - half; ++i) {
+            if (curvature[i] >= 0 && curvature[i] <= plane_curvature
+                && (spaced < 0 || (ring[i] - ring[spaced]).squaredNorm() >= dense_plane_spacing * dense_plane_spacing)) {
+                features.dense_planes->push_back(pcl::PointXYZ(ring[i].x(), ring[i].y(), ring[i].z()));
+                spaced = i;
+            }
+        }
+
+        for (int sector = 0; sector < sectors; ++sector) {
+            const int first = half + (n - 2 * half) * sector / sectors;
+            const int last = half + (n - 2 * half) * (sector + 1) / sectors;
+            order.clear();
+            for (int i = first; i < last; ++i) {
+                if (curvature[i] >= 0) {
+                    order.push_back(i);
+                }
+            }
+            std::sort(order.begin(), order.end(), [&curvature](int a, int b) { return curvature[a] > curvature[b]; });
+
+            // Marks the neighbourhood of a selected return
+            const auto pick = [&](int i) {
+                for (int j = std::max(i - half, 0); j <= std::min(i + half, n - 1); ++j) {
+                    picked[j] = 1;
+                }
+            };
+
+            // The sharpest dense edges are also edges
+            int edges = 0;
+            for (std::size_t k = 0; k < order.size() && edges < dense_edges_factor * edges_per_sector; ++k) {
+                const int i = order[k];
+                if (curvature[i] < edge_curvature) {
+                    break;
+                }
+                if (!picked[i]) {
+                    const pcl::PointXYZ point(ring[i].x(), ring[i].y(), ring[i].z());
+                    features.dense_edges->push_back(point);
+                    if (edges < edges_per_sector) {
+                        features.edges->push_back(point);
+                    }
+                    pick(i);
+                    ++edges;
+                }
+            }
+
+            int planes = 0;
+            for (std::size_t k = order.size(); k > 0 && planes < planes_per_sector; --k) {
+                const int i = order[k - 1];
+                if (curvature[i] > plane_curvature) {
+                    break;
+                }
+                if (!picked[i]) {
+                    features.planes->push_back(pcl::PointXYZ(ring[i].x(), ring[i].y(), ring[i].z()));
+                    pick(i);
+                    ++planes;
+                }
+            }
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+FeatureICP::FeatureICP()
+    : transformation_epsilon_{0},
+      max_correspondence_distance_{0.5},
+      maximum_iterations_{10},
+      outlier_threshold_{0.05},
+      transformation_(Eigen::Matrix4f::Identity()),
+      converged_{false}
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+FeatureICP::setInputTarget(const ScanFeatures::ConstPtr &target)
+{
+    if (target == target_) {
+        return;
+    }
+    target_ = target;
+    edge_index_.reset(new index_t);
+    plane_index_.reset(new index_t);
+    if (!target->dense_edges->empty()) {
+        edge_index_->setInputCloud(target->dense_edges);
+    }
+    if (!target->dense_planes->empty()) {
+        plane_index_->setInputCloud(target->dense_planes);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+FeatureICP::setInputSource(const ScanFeatures::ConstPtr &source)
+{
+    source_ = source;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+NormalEquations
+FeatureICP::linearize(const Eigen::Matrix4f &transformation) const
+{
+    const Eigen::Matrix3f rotation = transformation.topLeftCorner<3, 3>();
+    const Eigen::Vector3f translation = transformation.col(3).head<3>();
+    const float max_distance_squared = feature_neighbour_distance * feature_neighbour_distance;
+    const long edges = target_->dense_edges->empty() ? 0 : static_cast<long>(source_->edges->size());
+    const long planes = target_->dense_planes->empty() ? 0 : static_cast<long>(source_->planes->size());
+
+    NormalEquations system;
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+        std::vector<int> index(plane_neighbours);
+        std::vector<float> distance_squared(plane_neighbours);
+        pcl::PointXYZ query;
+
+#ifdef _OPENMP
+#pragma omp for schedule(static) reduction(+:system)
+#endif
+        for (long i = 0; i < edges + planes; ++i) {
+            const bool edge = i < edges;
+            const pcl::PointXYZ &s = edge ? source_->edges->points[i] : source_->planes->points[i - edges];
+            const Eigen::Vector3f p = rotation * s.getVector3fMap() + translation;
+            query.getVector3fMap() = p;
+            const index_t &search = edge ? *edge_index_ : *plane_index_;
+            const ScanFeatures::cloud_t &target = edge ? *target_->dense_edges : *target_->dense_planes;
+            const int neighbours = edge ? edge_neighbours : plane_neighbours;
+            if (search.nearestKSearch(query, neighbours, index, distance_squared) < neighbours
+                || distance_squared[neighbours - 1] > max_distance_squared) {
+                continue;
+            }
+
+            Eigen::Vector3f mean = Eigen::Vector3f::Zero();
+            for (int k = 0; k < neighbours; ++k) {
+                mean += target.points[index[k]].getVector3fMap();
+            }
+            mean /= neighbours;
+            Eigen::Matrix3f covariance = Eigen::Matrix3f::Zero();
+            for (int k = 0; k < neighbours; ++k) {
+                const Eigen::Vector3f d = target.points[index[k]].getVector3fMap() - mean;
+                covariance.noalias() += d * d.transpose();
+            }
+            const Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> solver(covariance);
+            const Eigen::Vector3f &eigenvalues = solver.eigenvalues();
+
+            // Direction of the residual, away from the line or the plane
+            Eigen::Vector3f normal;
+            if (edge) {
+                if (eigenvalues(2) < line_eigenvalue_ratio * eigenvalues(1)) {
+                    continue;
+                }
+                const Eigen::Vector3f direction = solver.eigenvectors().col(2);
+                const Eigen::Vector3f offset = (p - mean) - (p - mean).dot(direction) * direction;
+                const float distance = offset.norm();
+                if (distance < 1e-6f) {
+                    continue;
+                }
+                normal = offset / distance;
+            } else {
+                if (eigenvalues(0) > plane_thickness_ratio * eigenvalues(1)
+                    || eigenvalues(1) < plane_spread_ratio * eigenvalues(2)) {
+                    continue;
+                }
+                normal = solver.eigenvectors().col(0);
+            }
+            const double residual = (p - mean).dot(normal);
+            if (std::abs(residual) > max_correspondence_distance_) {
+                continue;
+            }
+
+            // A small motion (translation t, rotation r) changes the residual by n.t + (p x n).r
+            Eigen::Matrix<double, 6, 1> J;
+            J.head<3>() = normal.cast<double>();
+            J.tail<3>() = p.cross(normal).cast<double>();
+            const double weight = std::abs(residual) <= outlier_threshold_ ? 1 : outlier_threshold_ / std::abs(residual);
+            system.add(J, residual, weight);
+        }
+    }
+    return system;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+FeatureICP::align(const Eigen::Matrix4f &guess)
+{
+    transformation_ = guess;
+    converged_ = false;
+    Convergence convergence(transformation_epsilon_);
+    for (int iteration = 0; iteration < maximum_iterations_; ++iteration) {
+        NormalEquations system = linearize(transformation_);
+        if (system.correspondences < 6) {
+            break;
+        }
+        add_prior(transformation_, system);
+        const Eigen::Matrix<double, 6, 1> delta = system.solve();
+        apply_left_step(delta, transformation_);
+        if (convergence.converged(delta)) {
+            converged_ = true;
+            break;
+        }
+    }
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
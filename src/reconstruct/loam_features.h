@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/search/kdtree.h>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+#include "gauss_newton.h"
+#include "range_image.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Edge and planar points of a scan, as in LOAM. The sparse sets are the sharp and flat points that
+// are aligned as the source, the dense sets the less sharp and less flat points that the lines and
+// planes are fitted through as the target.
+struct ScanFeatures
+{
+    typedef pcl::PointCloud<pcl::PointXYZ> cloud_t;
+    typedef std::shared_ptr<ScanFeatures> Ptr;
+    typedef std::shared_ptr<const ScanFeatures> ConstPtr;
+
+    ScanFeatures() : edges(new cloud_t), planes(new cloud_t), dense_edges(new cloud_t), dense_planes(new cloud_t) {}
+
+    cloud_t::Ptr edges;
+    cloud_t::Ptr planes;
+    cloud_t::Ptr dense_edges;
+    cloud_t::Ptr dense_planes;
+};
+
+// Milliseconds spent in the stages of feature odometry and the features it used
+struct FeatureTiming
+{
+    FeatureTiming() : extraction{0}, indexing{0}, alignment{0}, scans{0}, edges{0}, planes{0} {}
+
+    double extraction;
+    double indexing;
+    double alignment;
+    std::size_t scans;
+    std::size_t edges;
+    std::size_t planes;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Selects the features of a range image. Along every ring the curvature of a return is the turn
+// between the mean directions to its neighbours on both sides, 0 on a straight line and 0.7 on a
+// right-angled corner, so it does not depend on the range or the angle of incidence. Returns whose
+// neighbourhood spans a gap or a jump in range are occluded or occluding and are never selected.
+// Every ring is split into sectors and each sector contributes at most edges_per_sector returns of
+// the highest and planes_per_sector of the lowest curvature, so the features cover the whole scan.
+// The neighbours of a selected return are not selected again. The dense edges are selected the same
+// way with a few times as many per sector and include the edges; the dense planar points are all
+// planar returns, thinned along the ring.
+void
+extract_features(const RangeImage &image,
+                 ScanFeatures &features,
+                 const int sectors = 8,
+                 const int edges_per_sector = 4,
+                 const int planes_per_sector = 10);
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Aligns the features of two scans with Gauss-Newton: source edges with the line through their
+// closest dense target edges and source planar points with the plane through their closest dense
+// target planar points. A line is accepted if the neighbours are clearly elongated, a plane if they
+// are flat and spread in two directions. Both residuals are distances along one direction, so they
+// share the point-to-plane Jacobian. The correspondence search and the accumulation run on all
+// OpenMP threads.
+class FeatureICP : public PosePrior
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    typedef pcl::search::KdTree<pcl::PointXYZ> index_t;
+
+    FeatureICP();
+
+    void setTransformationEpsilon(double epsilon) { transformation_epsilon_ = epsilon; }
+    void setMaxCorrespondenceDistance(double distance) { max_correspondence_distance_ = distance; }
+    void setMaximumIterations(int iterations) { maximum_iterations_ = iterations; }
+    void setRANSACOutlierRejectionThreshold(double threshold) { outlier_threshold_ = threshold; }
+
+    // Builds the search trees of the dense target edges and planar points
+    void
+    setInputTarget(const ScanFeatures::ConstPtr &target);
+
+    void
+    setInputSource(const ScanFeatures::ConstPtr &source);
+
+    void
+    align(const Eigen::Matrix4f &guess = Eigen::Matrix4f::Identity());
+
+    Eigen::Matrix4f getFinalTransformation() const { return transformation_; }
+    bool            hasConverged() const { return converged_; }
+
+private:
+    // Gauss-Newton system of the correspondences at `transformation`
+    NormalEquations
+    linearize(const Eigen::Matrix4f &transformation) const;
+
+    double transformation_epsilon_;
+    double max_correspondence_distance_;
+    int maximum_iterations_;
+    double outlier_threshold_;
+
+    ScanFeatures::ConstPtr target_;
+    ScanFeatures::ConstPtr source_;
+    index_t::Ptr edge_index_;
+    index_t::Ptr plane_index_;
+
+    Eigen::Matrix4f transformation_;
+    bool converged_;
+};
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
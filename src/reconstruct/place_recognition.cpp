@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+#include "place_recognition.h"
+
+// Polar grid of the descriptor, the radius covers a large room seen from the tripod
+constexpr int scan_context_rings = 20;
+constexpr int scan_context_sectors = 60;
+constexpr float scan_context_max_radius = 20;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ScanContext::ScanContext(const pcl::PointCloud<pcl::PointXYZ> &cloud)
+    : descriptor_(Eigen::MatrixXf::Zero(scan_context_rings, scan_context_sectors)),
+      ring_key_(Eigen::VectorXf::Zero(scan_context_rings))
+{
+    float z_min = std::numeric_limits<float>::max();
+    for (std::size_t i = 0; i < cloud.size(); ++i) {
+        if (std::isfinite(cloud.points[i].z)) {
+            z_min = std::min(z_min, cloud.points[i].z);
+        }
+    }
+
+    for (std::size_t i = 0; i < cloud.size(); ++i) {
+        const pcl::PointXYZ &p = cloud.points[i];
+        const float radius = std::sqrt(p.x * p.x + p.y * p.y);
+        if (!std::isfinite(radius) || !std::isfinite(p.z) || radius >= scan_context_max_radius) {
+            continue;
+        }
+        const int ring = static_cast<int>(radius / scan_context_max_radius * scan_context_rings);
+        const float angle = std::atan2(p.y, p.x) + static_cast<float>(M_PI);
+        const int sector = std::min(scan_context_sectors - 1,
+                                    static_cast<int>(angle / (2 * M_PI) * scan_context_sectors));
+        descriptor_(ring, sector) = std::max(descriptor_(ring, sector), p.z - z_min);
+    }
+
+    for (int ring = 0; ring < scan_context_rings; ++ring) {
+        ring_key_(ring) = static_cast<float>((descriptor_.row(ring).array() > 0).count()) / scan_context_sectors;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+float
+ScanContext::distance(const ScanContext &other) const
+{
+    const Eigen::VectorXf norms = descriptor_.colwise().norm();
+    const Eigen::VectorXf other_norms = other.descriptor_.colwise().norm();
+
+    float best = std::numeric_limits<float>::max();
+    for (int shift = 0; shift < scan_context_sectors; ++shift) {
+        float sum = 0;
+        int columns = 0;
+        for (int c = 0; c < scan_context_sectors; ++c) {
+            const int d = (c + shift) % scan_context_sectors;
+            if (norms(c) == 0 || other_norms(d) == 0) {
+                continue;
+            }
+            sum += 1 - descriptor_.col(c).dot(other.descriptor_.col(d)) / (norms(c) * other_norms(d));
+            ++columns;
+        }
+        if (columns > 0) {
+            best = std::min(best, sum / columns);
+        }
+    }
+    return best;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+PlaceIndex::PlaceIndex(std::size_t exclude_neighbours, std::size_t ring_key_candidates)
+    : exclude_neighbours_{exclude_neighbours},
+      ring_key_candidates_{ring_key_candidates}
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+PlaceIndex::add(const ScanContext &context)
+{
+    contexts_.push_back(context);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+std::vector<PlaceIndex::Candidate>
+PlaceIndex::candidates(std::size_t k, float max_distance) const
+{
+    std::vector<Candidate> candidates;
+    for (std::size_t j = exclude_neighbours_ + 1; j < contexts_.size(); ++j) {
+        // Closest ring keys among the earlier fragments
+        std::vector<std::pair<float, std::size_t> > ring_key_distances;
+        for (std::size_t i = 0; i + exclude_neighbours_ < j; ++i) {
+            ring_key_distances.push_back(std::make_pair(
+                (contexts_[i].ring_key() - contexts_[j].ring_key()).squaredNorm(), i));
+        }
+        const std::size_t n = std::min(ring_key_candidates_, ring_key_distances.size());
+        std::partial_sort(ring_key_distances.begin(), ring_key_distances.begin() + n, ring_key_distances.end());
+
+        // Best full descriptor match among them
+        Candidate best = {0, j, std::numeric_limits<float>::max()};
+        for (std::size_t c = 0; c < n; ++c) {
+            const float distance = contexts_[ring_key_distances[c].second].distance(contexts_[j]);
+            if (distance < best.distance) {
+                best.i = ring_key_distances[c].second;
+                best.distance = distance;
+            }
+        }
+        if (best.distance <= max_distance) {
+            candidates.push_back(best);
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Candidate &a, const Candidate &b) { return a.distance < b.distance; });
+    if (candidates.size() > k) {
+        candidates.resize(k);
+    }
+    return candidates;
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Scan context descriptor of a fragment: a polar grid around the scanner (rings x sectors) holding
+// the maximum height of the points in each bin above the lowest point of the fragment. The ring key,
+// the occupancy of every ring, does not depend on the heading and is used for the coarse search.
+class ScanContext
+{
+public:
+    explicit ScanContext(const pcl::PointCloud<pcl::PointXYZ> &cloud);
+
+    const Eigen::VectorXf &ring_key() const { return ring_key_; }
+
+    // Mean cosine distance of the sector columns in [0, 2], minimized over all headings
+    float
+    distance(const ScanContext &other) const;
+
+private:
+    Eigen::MatrixXf descriptor_;
+    Eigen::VectorXf ring_key_;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Index of the scan contexts of all fragments, fragment i is the i-th added. The ring keys are
+// compared exhaustively, which takes milliseconds for thousands of fragments, and only the closest
+// ring keys are compared with the full descriptor.
+class PlaceIndex
+{
+public:
+    struct Candidate
+    {
+        std::size_t i;
+        std::size_t j;
+        float distance;
+    };
+
+    // Pairs of fragments within exclude_neighbours of each other in the sequence are skipped as
+    // candidates
+    explicit PlaceIndex(std::size_t exclude_neighbours = 2, std::size_t ring_key_candidates = 10);
+
+    void
+    add(const ScanContext &context);
+
+    std::size_t size() const { return contexts_.size(); }
+
+    // Up to k pairs i < j, the best match of every fragment j, ordered by descriptor distance.
+    // Pairs above max_distance are dropped.
+    std::vector<Candidate>
+    candidates(std::size_t k, float max_distance = 0.5f) const;
+
+private:
+    std::size_t exclude_neighbours_;
+    std::size_t ring_key_candidates_;
+    std::vector<ScanContext> contexts_;
+};
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
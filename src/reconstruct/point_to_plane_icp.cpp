@@ -0,0 +1,192 @@
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <pcl/common/transforms.h>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+#include "point_to_plane_icp.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+PointToPlaneICP::PointToPlaneICP()
+    : transformation_epsilon_{0},
+      euclidean_fitness_epsilon_{-std::numeric_limits<double>::max()},
+      max_correspondence_distance_{std::sqrt(std::numeric_limits<double>::max())},
+      maximum_iterations_{10},
+      outlier_threshold_{0.05},
+      symmetric_{false},
+      gravity_constrained_{false},
+      transformation_(Eigen::Matrix4f::Identity()),
+      converged_{false}
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+PointToPlaneICP::setSearchMethodTarget(const index_t::Ptr &index, const cloud_t::ConstPtr &indexed_target)
+{
+    prebuilt_index_ = index;
+    prebuilt_target_ = indexed_target;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+PointToPlaneICP::setInputTarget(const cloud_t::ConstPtr &target)
+{
+    if (target == target_ && index_) {
+        return;
+    }
+    target_ = target;
+    if (prebuilt_index_ && target == prebuilt_target_) {
+        index_ = prebuilt_index_;
+    } else {
+        index_.reset(new index_t);
+        index_->setInputCloud(target);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+PointToPlaneICP::setInputSource(const cloud_t::ConstPtr &source)
+{
+    source_ = source;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+NormalEquations
+PointToPlaneICP::linearize(const Eigen::Matrix4f &transformation) const
+{
+    const Eigen::Matrix3f rotation = transformation.topLeftCorner<3, 3>();
+    const Eigen::Vector3f translation = transformation.col(3).head<3>();
+    const float max_distance_squared = static_cast<float>(max_correspondence_distance_ * max_correspondence_distance_);
+    const long n = static_cast<long>(source_->size());
+
+    NormalEquations system;
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+        std::vector<int> index(1);
+        std::vector<float> distance_squared(1);
+        pcl::PointNormal query;
+
+#ifdef _OPENMP
+#pragma omp for schedule(static) reduction(+:system)
+#endif
+        for (long i = 0; i < n; ++i) {
+            const pcl::PointNormal &s = source_->points[i];
+            const Eigen::Vector3f p = rotation * s.getVector3fMap() + translation;
+            query.getVector3fMap() = p;
+            if (!p.allFinite()
+                || index_->nearestKSearch(query, 1, index, distance_squared) == 0
+                || distance_squared[0] > max_distance_squared) {
+                continue;
+            }
+            const pcl::PointNormal &t = target_->points[index[0]];
+            Eigen::Vector3f normal = t.getNormalVector3fMap();
+            if (symmetric_) {
+                normal += rotation * s.getNormalVector3fMap();
+            }
+            const float norm = normal.norm();
+            if (!std::isfinite(norm) || norm < 1e-6f) {
+                continue;
+            }
+            normal /= norm;
+
+            // A small motion (translation t, rotation r) changes the residual by n.t + (p x n).r
+            const double residual = (p - t.getVector3fMap()).dot(normal);
+            Eigen::Matrix<double, 6, 1> J;
+            J.head<3>() = normal.cast<double>();
+            J.tail<3>() = p.cross(normal).cast<double>();
+            const double weight = std::abs(residual) <= outlier_threshold_ ? 1 : outlier_threshold_ / std::abs(residual);
+            system.add(J, residual, weight);
+        }
+    }
+    return system;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+PointToPlaneICP::align(cloud_t &output)
+{
+    align(output, Eigen::Matrix4f::Identity());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+PointToPlaneICP::align(cloud_t &output, const Eigen::Matrix4f &guess)
+{
+    transformation_ = guess;
+    converged_ = false;
+    Convergence convergence(transformation_epsilon_, euclidean_fitness_epsilon_);
+    for (int iteration = 0; iteration < maximum_iterations_; ++iteration) {
+        const NormalEquations system = linearize(transformation_);
+        if (system.correspondences < 6) {
+            break;
+        }
+
+        // Gauss-Newton step, applied on the left. With gravity the rotation is about z only: the
+        // system of (t, r_z) is solved and the roll and pitch of the step are zero.
+        Eigen::Matrix<double, 6, 1> delta = Eigen::Matrix<double, 6, 1>::Zero();
+        if (gravity_constrained_) {
+            const int dofs[4] = {0, 1, 2, 5};
+            Eigen::Matrix4d H4;
+            Eigen::Vector4d b4;
+            for (int r = 0; r < 4; ++r) {
+                for (int c = 0; c < 4; ++c) {
+                    H4(r, c) = system.H(dofs[r], dofs[c]);
+                }
+                b4(r) = system.b(dofs[r]);
+            }
+            const Eigen::Vector4d delta4 = H4.ldlt().solve(-b4);
+            for (int r = 0; r < 4; ++r) {
+                delta(dofs[r]) = delta4(r);
+            }
+        } else {
+            delta = system.solve();
+        }
+        apply_left_step(delta, transformation_);
+        if (convergence.converged(delta, system.squared_error / system.correspondences)) {
+            converged_ = true;
+            break;
+        }
+    }
+    pcl::transformPointCloudWithNormals(*source_, output, transformation_);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double
+PointToPlaneICP::getFitnessScore(double max_range) const
+{
+    const Eigen::Matrix3f rotation = transformation_.topLeftCorner<3, 3>();
+    const Eigen::Vector3f translation = transformation_.col(3).head<3>();
+    const long n = static_cast<long>(source_->size());
+
+    double squared_distances = 0;
+    long correspondences = 0;
+#ifdef _OPENMP
+#pragma omp parallel reduction(+:squared_distances, correspondences)
+#endif
+    {
+        std::vector<int> index(1);
+        std::vector<float> distance_squared(1);
+        pcl::PointNormal query;
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (long i = 0; i < n; ++i) {
+            query.getVector3fMap() = rotation * source_->points[i].getVector3fMap() + translation;
+            if (index_->nearestKSearch(query, 1, index, distance_squared) > 0
+                && distance_squared[0] <= max_range) {
+                squared_distances += distance_squared[0];
+                ++correspondences;
+            }
+        }
+    }
+    return correspondences > 0 ? squared_distances / correspondences : std::numeric_limits<double>::max();
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
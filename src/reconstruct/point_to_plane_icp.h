@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/search/kdtree.h>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+#include "gauss_newton.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Point-to-plane ICP, optionally with the symmetric objective (the normals of both clouds). The
+// correspondence search and the accumulation of the 6x6 Gauss-Newton system run on all OpenMP
+// threads with per-thread sums. The target index is built once per target and can be handed in
+// prebuilt to reuse it across alignments. Residuals above the outlier threshold are down-weighted
+// (Huber). The interface follows pcl::Registration so it can be used wherever the PCL classes are.
+class PointToPlaneICP
+{
+public:
+    typedef pcl::PointCloud<pcl::PointNormal> cloud_t;
+    typedef pcl::search::KdTree<pcl::PointNormal> index_t;
+
+    PointToPlaneICP();
+
+    void setTransformationEpsilon(double epsilon) { transformation_epsilon_ = epsilon; }
+    void setEuclideanFitnessEpsilon(double epsilon) { euclidean_fitness_epsilon_ = epsilon; }
+    void setMaxCorrespondenceDistance(double distance) { max_correspondence_distance_ = distance; }
+    void setMaximumIterations(int iterations) { maximum_iterations_ = iterations; }
+    void setRANSACOutlierRejectionThreshold(double threshold) { outlier_threshold_ = threshold; }
+    void setUseSymmetricObjective(bool symmetric) { symmetric_ = symmetric; }
+
+    // Solves yaw and translation only and keeps the roll and pitch of the guess, for clouds leveled
+    // with gravity along z. The Gauss-Newton system shrinks to 4x4.
+    void setGravityConstrained(bool constrained) { gravity_constrained_ = constrained; }
+
+    // `index` must have been built on `indexed_target`. It is used instead of building a new one
+    // whenever that cloud is set as the target.
+    void
+    setSearchMethodTarget(const index_t::Ptr &index, const cloud_t::ConstPtr &indexed_target);
+
+    void
+    setInputTarget(const cloud_t::ConstPtr &target);
+
+    void
+    setInputSource(const cloud_t::ConstPtr &source);
+
+    void
+    align(cloud_t &output);
+
+    void
+    align(cloud_t &output, const Eigen::Matrix4f &guess);
+
+    Eigen::Matrix4f getFinalTransformation() const { return transformation_; }
+    bool            hasConverged() const { return converged_; }
+
+    // Mean squared distance of the aligned source points to their closest target point
+    double
+    getFitnessScore(double max_range = std::numeric_limits<double>::max()) const;
+
+private:
+    // Gauss-Newton system of the correspondences at `transformation`
+    NormalEquations
+    linearize(const Eigen::Matrix4f &transformation) const;
+
+    double transformation_epsilon_;
+    double euclidean_fitness_epsilon_;
+    double max_correspondence_distance_;
+    int maximum_iterations_;
+    double outlier_threshold_;
+    bool symmetric_;
+    bool gravity_constrained_;
+
+    cloud_t::ConstPtr target_;
+    cloud_t::ConstPtr source_;
+    index_t::Ptr index_;
+    index_t::Ptr prebuilt_index_;
+    cloud_t::ConstPtr prebuilt_target_;
+
+    Eigen::Matrix4f transformation_;
+    bool converged_;
+};
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
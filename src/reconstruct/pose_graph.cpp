@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+#else
+#include <eigen3/Eigen/Dense>
+#include <eigen3/Eigen/Sparse>
+#endif
+
+#include "pose_graph.h"
+
+// Below this angle the inverse right Jacobian of SO(3) is used to first order
+constexpr double small_angle = 1e-6;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static Eigen::Matrix3d
+rotation_exp(const Eigen::Vector3d &rotation_vector)
+{
+    const double angle = rotation_vector.norm();
+    if (angle < 1e-12) {
+        return Eigen::Matrix3d::Identity();
+    }
+    return Eigen::AngleAxisd(angle, rotation_vector / angle).toRotationMatrix();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static Eigen::Vector3d
+rotation_log(const Eigen::Matrix3d &rotation)
+{
+    const Eigen::AngleAxisd angle_axis(rotation);
+    return angle_axis.angle() * angle_axis.axis();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static Eigen::Matrix3d
+skew(const Eigen::Vector3d &v)
+{
+    Eigen::Matrix3d m;
+    m <<     0, -v.z(),  v.y(),
+         v.z(),      0, -v.x(),
+        -v.y(),  v.x(),      0;
+    return m;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Inverse of the right Jacobian of SO(3): log(exp(phi) exp(delta)) = phi + J^-1 delta to first order
+static Eigen::Matrix3d
+inverse_right_jacobian(const Eigen::Vector3d &phi)
+{
+    const double angle = phi.norm();
+    const Eigen::Matrix3d phi_hat = skew(phi);
+    if (angle < small_angle) {
+        return Eigen::Matrix3d::Identity() + 0.5 * phi_hat;
+    }
+    const double factor = 1 / (angle * angle) - (1 + std::cos(angle)) / (2 * angle * std::sin(angle));
+    return Eigen::Matrix3d::Identity() + 0.5 * phi_hat + factor * phi_hat * phi_hat;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+std::size_t
+PoseGraph::add_node(const Eigen::Matrix4d &pose)
+{
+    R_.push_back(pose.topLeftCorner<3, 3>());
+    t_.push_back(pose.col(3).head<3>());
+    return R_.size() - 1;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+PoseGraph::add_edge(std::size_t i, std::size_t j, const Eigen::Matrix4d &relative, const information_t &information)
+{
+    Edge edge;
+    edge.i = i;
+    edge.j = j;
+    edge.R = relative.topLeftCorner<3, 3>();
+    edge.t = relative.col(3).head<3>();
+    edge.information = information;
+    edges_.push_back(edge);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+Eigen::Matrix4d
+PoseGraph::pose(std::size_t i) const
+{
+    Eigen::Matrix4d pose = Eigen::Matrix4d::Identity();
+    pose.topLeftCorner<3, 3>() = R_[i];
+    pose.col(3).head<3>() = t_[i];
+    return pose;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+PoseGraph::error_t
+PoseGraph::error(const Edge &edge,
+                 const Eigen::Matrix3d &Ri, const Eigen::Vector3d &ti,
+                 const Eigen::Matrix3d &Rj, const Eigen::Vector3d &tj)
+{
+    // Predicted pose of j in the frame of i compared with the measured one
+    error_t e;
+    e.head<3>() = edge.R.transpose() * (Ri.transpose() * (tj - ti) - edge.t);
+    e.tail<3>() = rotation_log(edge.R.transpose() * Ri.transpose() * Rj);
+    return e;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double
+PoseGraph::cost() const
+{
+    double cost = 0;
+    for (std::size_t k = 0; k < edges_.size(); ++k) {
+        const Edge &edge = edges_[k];
+        const error_t e = error(edge, R_[edge.i], t_[edge.i], R_[edge.j], t_[edge.j]);
+        cost += e.dot(edge.information * e);
+    }
+    return cost;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int
+PoseGraph::optimize(int max_iterations)
+{
+    // Node 0 fixes the gauge, node k > 0 owns the variables 6 (k - 1) .. 6 (k - 1) + 5. An update
+    // is (translation, rotation vector), the rotation vector is applied on the right.
+    if (size() < 2 || edges_.empty()) {
+        return 0;
+    }
+    const int variables = 6 * static_cast<int>(size() - 1);
+
+    double lambda = 1e-4;
+    double current_cost = cost();
+    int iteration = 0;
+    for (; iteration < max_iterations; ++iteration) {
+        // Normal equations
+        std::vector<Eigen::Triplet<double> > triplets;
+        triplets.reserve(edges_.size() * 4 * 36);
+        Eigen::VectorXd b = Eigen::VectorXd::Zero(variables);
+        for (std::size_t k = 0; k < edges_.size(); ++k) {
+            const Edge &edge = edges_[k];
+            const std::size_t nodes[2] = {edge.i, edge.j};
+            const Eigen::Matrix3d &Ri = R_[edge.i];
+            const error_t e = error(edge, Ri, t_[edge.i], R_[edge.j], t_[edge.j]);
+
+            // Analytic Jacobians with respect to both nodes. Rotating node i by exp(delta) on the
+            // right rotates the predicted relative pose by exp(-delta) on the left, rotating node j
+            // rotates its rotation on the right.
+            const Eigen::Matrix3d measured_i = edge.R.transpose() * Ri.transpose();
+            const Eigen::Matrix3d rotation_error = measured_i * R_[edge.j];
+            const Eigen::Matrix3d J_rotation = inverse_right_jacobian(e.tail<3>());
+            Eigen::Matrix<double, 6, 12> J = Eigen::Matrix<double, 6, 12>::Zero();
+            J.block<3, 3>(0, 0) = -measured_i;
+            J.block<3, 3>(0, 3) = edge.R.transpose() * skew(Ri.transpose() * (t_[edge.j] - t_[edge.i]));
+            J.block<3, 3>(3, 3) = -J_rotation * rotation_error.transpose() * edge.R.transpose();
+            J.block<3, 3>(0, 6) = measured_i;
+            J.block<3, 3>(3, 9) = J_rotation;
+
+            const Eigen::Matrix<double, 12, 12> H = J.transpose() * edge.information * J;
+            const Eigen::Matrix<double, 12, 1> g = J.transpose() * edge.information * e;
+            for (int n = 0; n < 2; ++n) {
+                if (nodes[n] == 0) {
+                    continue;
+                }
+                const int row = 6 * static_cast<int>(nodes[n] - 1);
+                b.segment<6>(row) += g.segment<6>(6 * n);
+                for (int m = 0; m < 2; ++m) {
+                    if (nodes[m] == 0) {
+                        continue;
+                    }
+                    const int col = 6 * static_cast<int>(nodes[m] - 1);
+                    for (int r = 0; r < 6; ++r) {
+                        for (int c = 0; c < 6; ++c) {
+                            triplets.push_back(Eigen::Triplet<double>(row + r, col + c, H(6 * n + r, 6 * m + c)));
+                        }
+                    }
+                }
+            }
+        }
+        Eigen::SparseMatrix<double> H(variables, variables);
+        H.setFromTriplets(triplets.begin(), triplets.end());
+        const Eigen::VectorXd diagonal = H.diagonal();
+
+        // Levenberg-Marquardt: raise the damping until the cost decreases
+        bool improved = false;
+        while (!improved && lambda < 1e8) {
+            Eigen::SparseMatrix<double> H_damped = H;
+            for (int k = 0; k < variables; ++k) {
+                H_damped.coeffRef(k, k) += lambda * (diagonal(k) + 1e-9);
+            }
+            Eigen::SimplicialLDLT<Eigen::SparseMatrix<double> > solver(H_damped);
+            if (solver.info() != Eigen::Success) {
+                lambda *= 10;
+                continue;
+            }
+            const Eigen::VectorXd dx = solver.solve(-b);
+
+            const std::vector<Eigen::Matrix3d> R_previous = R_;
+            const std::vector<Eigen::Vector3d> t_previous = t_;
+            for (std::size_t n = 1; n < size(); ++n) {
+                const int row = 6 * static_cast<int>(n - 1);
+                t_[n] += dx.segment<3>(row);
+                R_[n] = R_[n] * rotation_exp(dx.segment<3>(row + 3));
+            }
+            const double new_cost = cost();
+            if (new_cost < current_cost) {
+                improved = true;
+                lambda = std::max(lambda / 10, 1e-10);
+                const bool converged = current_cost - new_cost < 1e-9 * current_cost;
+                current_cost = new_cost;
+                if (converged) {
+                    return iteration + 1;
+                }
+            } else {
+                R_ = R_previous;
+                t_ = t_previous;
+                lambda *= 10;
+            }
+        }
+        if (!improved) {
+            break;
+        }
+    }
+    return iteration;
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Pose graph of fragments. Nodes are fragment poses in the frame of the first fragment, edges are
+// measured relative poses between two fragments weighted by a 6x6 information matrix ordered
+// (translation, rotation). optimize() runs Levenberg-Marquardt on a sparse Cholesky factorization
+// with the first node fixed.
+class PoseGraph
+{
+public:
+    typedef Eigen::Matrix<double, 6, 6> information_t;
+
+    // Returns the index of the node
+    std::size_t
+    add_node(const Eigen::Matrix4d &pose);
+
+    // `relative` is the pose of node j in the frame of node i
+    void
+    add_edge(std::size_t i, std::size_t j, const Eigen::Matrix4d &relative, const information_t &information);
+
+    std::size_t size() const { return R_.size(); }
+    std::size_t edges() const { return edges_.size(); }
+
+    Eigen::Matrix4d
+    pose(std::size_t i) const;
+
+    // Sum of the squared edge errors weighted by their information
+    double
+    cost() const;
+
+    // Returns the number of iterations done
+    int
+    optimize(int max_iterations = 20);
+
+private:
+    struct Edge
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+        std::size_t i;
+        std::size_t j;
+        Eigen::Matrix3d R;
+        Eigen::Vector3d t;
+        information_t information;
+    };
+    typedef Eigen::Matrix<double, 6, 1> error_t;
+
+    // Translation error in the frame of the measurement and rotation error as rotation vector
+    static error_t
+    error(const Edge &edge,
+          const Eigen::Matrix3d &Ri, const Eigen::Vector3d &ti,
+          const Eigen::Matrix3d &Rj, const Eigen::Vector3d &tj);
+
+    // Node poses
+    std::vector<Eigen::Matrix3d> R_;
+    std::vector<Eigen::Vector3d> t_;
+
+    std::vector<Edge, Eigen::aligned_allocator<Edge> > edges_;
+};
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
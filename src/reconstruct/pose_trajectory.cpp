@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+#include "pose_trajectory.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Angles below this are interpolated linearly (followed by normalization) instead of with sin()
+static constexpr double small_angle = 1e-6;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static inline void
+slerp_weights(double theta, double inv_sin_theta, double u, double &a, double &b)
+{
+    if (inv_sin_theta == 0.0) {
+        a = 1.0 - u;
+        b = u;
+    } else {
+        a = std::sin((1.0 - u) * theta) * inv_sin_theta;
+        b = std::sin(u * theta) * inv_sin_theta;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Shortest arc slerp between two arbitrary unit quaternions, used for the squad blending
+static inline void
+slerp(const double *p, const double *q, double u, double *r)
+{
+    double c = p[0] * q[0] + p[1] * q[1] + p[2] * q[2] + p[3] * q[3];
+    const double sign = c < 0.0 ? -1.0 : 1.0;
+    c = std::min(std::abs(c), 1.0);
+    const double theta = std::acos(c);
+    double a, b;
+    slerp_weights(theta, theta > small_angle ? 1.0 / std::sin(theta) : 0.0, u, a, b);
+    b *= sign;
+    for (int k = 0; k < 4; ++k) {
+        r[k] = a * p[k] + b * q[k];
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static Eigen::Quaterniond
+quaternion_log(const Eigen::Quaterniond &q)
+{
+    const double v = q.vec().norm();
+    if (v < small_angle) {
+        return Eigen::Quaterniond(0, q.x(), q.y(), q.z());
+    }
+    const double angle = std::atan2(v, q.w()) / v;
+    return Eigen::Quaterniond(0, q.x() * angle, q.y() * angle, q.z() * angle);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static Eigen::Quaterniond
+quaternion_exp(const Eigen::Quaterniond &q)
+{
+    const double v = q.vec().norm();
+    if (v < small_angle) {
+        return Eigen::Quaterniond(1, q.x(), q.y(), q.z()).normalized();
+    }
+    const double s = std::sin(v) / v;
+    return Eigen::Quaterniond(std::cos(v), q.x() * s, q.y() * s, q.z() * s);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+PoseTrajectory::PoseTrajectory(Interpolation interpolation)
+    : interpolation_{interpolation}
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+PoseTrajectory::PoseTrajectory(const quart_vector_t &quaternions_time, Interpolation interpolation)
+    : interpolation_{interpolation}
+{
+    const vector4d_t &quaternions = quaternions_time.first;
+    const std::vector<double> &times = quaternions_time.second;
+    for (std::size_t i = 0; i < quaternions.size(); ++i) {
+        if (i > 0 && quaternions[i].isApprox(quaternions[i - 1])) {
+            continue;
+        }
+        add(times[i], quaternions[i]);
+    }
+    // Hold the last reading until the end of the recording
+    if (!quaternions.empty() && times.back() > t_.back()) {
+        add(times.back(), quaternions.back());
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+PoseTrajectory::add(double time, const Eigen::Vector4d &quaternion)
+{
+    if (!t_.empty() && time <= t_.back()) {
+        return;
+    }
+    Eigen::Vector4d q = quaternion.normalized();
+    if (!t_.empty() && q(0) * w_.back() + q(1) * x_.back() + q(2) * y_.back() + q(3) * z_.back() < 0.0) {
+        q = -q;
+    }
+    t_.push_back(time);
+    w_.push_back(q(0));
+    x_.push_back(q(1));
+    y_.push_back(q(2));
+    z_.push_back(q(3));
+    sw_.push_back(q(0));
+    sx_.push_back(q(1));
+    sy_.push_back(q(2));
+    sz_.push_back(q(3));
+
+    const std::size_t n = t_.size();
+    if (n >= 2) {
+        const std::size_t i = n - 2;
+        const double c = std::min(w_[i] * w_[i + 1] + x_[i] * x_[i + 1] + y_[i] * y_[i + 1] + z_[i] * z_[i + 1], 1.0);
+        const double theta = std::acos(c);
+        theta_.push_back(theta);
+        inv_sin_theta_.push_back(theta > small_angle ? 1.0 / std::sin(theta) : 0.0);
+    }
+    if (n >= 3) {
+        update_squad_controls(n - 2);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+PoseTrajectory::update_squad_controls(std::size_t i)
+{
+    const Eigen::Quaterniond q_previous(w_[i - 1], x_[i - 1], y_[i - 1], z_[i - 1]);
+    const Eigen::Quaterniond q(w_[i], x_[i], y_[i], z_[i]);
+    const Eigen::Quaterniond q_next(w_[i + 1], x_[i + 1], y_[i + 1], z_[i + 1]);
+    const Eigen::Quaterniond q_inverse = q.conjugate();
+
+    const Eigen::Quaterniond log_next = quaternion_log(q_inverse * q_next);
+    const Eigen::Quaterniond log_previous = quaternion_log(q_inverse * q_previous);
+    const Eigen::Quaterniond tangent(0,
+                                     -0.25 * (log_next.x() + log_previous.x()),
+                                     -0.25 * (log_next.y() + log_previous.y()),
+                                     -0.25 * (log_next.z() + log_previous.z()));
+    const Eigen::Quaterniond s = (q * quaternion_exp(tangent)).normalized();
+    sw_[i] = s.w();
+    sx_[i] = s.x();
+    sy_[i] = s.y();
+    sz_[i] = s.z();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+std::size_t
+PoseTrajectory::segment(double time, std::size_t hint) const
+{
+    const std::size_t segments = t_.size() - 1;
+    if (hint < segments && t_[hint] <= time && time < t_[hint + 1]) {
+        return hint;
+    }
+    if (hint + 1 < segments && t_[hint + 1] <= time && time < t_[hint + 2]) {
+        return hint + 1;
+    }
+    const std::size_t upper = std::upper_bound(t_.begin(), t_.end(), time) - t_.begin();
+    return std::min(upper == 0 ? 0 : upper - 1, segments - 1);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+Eigen::Vector4d
+PoseTrajectory::at(double time) const
+{
+    Eigen::Vector4d q;
+    at(&time, 1, &q(0), &q(1), &q(2), &q(3));
+    return q;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+PoseTrajectory::at(const double *times, std::size_t n, double *w, double *x, double *y, double *z) const
+{
+    if (t_.size() < 2) {
+        const double q0[4] = {1, 0, 0, 0};
+        const bool single = t_.size() == 1;
+        for (std::size_t k = 0; k < n; ++k) {
+            w[k] = single ? w_[0] : q0[0];
+            x[k] = single ? x_[0] : q0[1];
+            y[k] = single ? y_[0] : q0[2];
+            z[k] = single ? z_[0] : q0[3];
+        }
+        return;
+    }
+
+    // Locate the segment and the normalized position within it for every query
+    std::vector<std::size_t> segments(n);
+    std::vector<double> u(n);
+    std::size_t hint = 0;
+    for (std::size_t k = 0; k < n; ++k) {
+        const std::size_t i = segment(times[k], hint);
+        segments[k] = hint = i;
+        const double s = (times[k] - t_[i]) / (t_[i + 1] - t_[i]);
+        u[k] = std::min(std::max(s, 0.0), 1.0);
+    }
+
+    // Slerp between the knots of every segment
+    #pragma omp simd
+    for (std::size_t k = 0; k < n; ++k) {
+        const std::size_t i = segments[k];
+        double a, b;
+        slerp_weights(theta_[i], inv_sin_theta_[i], u[k], a, b);
+        w[k] = a * w_[i] + b * w_[i + 1];
+        x[k] = a * x_[i] + b * x_[i + 1];
+        y[k] = a * y_[i] + b * y_[i + 1];
+        z[k] = a * z_[i] + b * z_[i + 1];
+    }
+
+    // Squad blends the slerp towards the slerp of the control points
+    if (interpolation_ == SQUAD) {
+        for (std::size_t k = 0; k < n; ++k) {
+            const std::size_t i = segments[k];
+            const double s0[4] = {sw_[i], sx_[i], sy_[i], sz_[i]};
+            const double s1[4] = {sw_[i + 1], sx_[i + 1], sy_[i + 1], sz_[i + 1]};
+            const double p[4] = {w[k], x[k], y[k], z[k]};
+            double s[4], r[4];
+            slerp(s0, s1, u[k], s);
+            slerp(p, s, 2.0 * u[k] * (1.0 - u[k]), r);
+            w[k] = r[0];
+            x[k] = r[1];
+            y[k] = r[2];
+            z[k] = r[3];
+        }
+    }
+
+    #pragma omp simd
+    for (std::size_t k = 0; k < n; ++k) {
+        const double inv_norm = 1.0 / std::sqrt(w[k] * w[k] + x[k] * x[k] + y[k] * y[k] + z[k] * z[k]);
+        w[k] *= inv_norm;
+        x[k] *= inv_norm;
+        y[k] *= inv_norm;
+        z[k] *= inv_norm;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+PoseTrajectory::at(const std::vector<double> &times, vector4d_t &quaternions) const
+{
+    const std::size_t n = times.size();
+    std::vector<double> w(n), x(n), y(n), z(n);
+    at(times.data(), n, w.data(), x.data(), y.data(), z.data());
+    quaternions.resize(n);
+    for (std::size_t k = 0; k < n; ++k) {
+        quaternions[k] << w[k], x[k], y[k], z[k];
+    }
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
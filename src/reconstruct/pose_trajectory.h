@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+#include "reco_types.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Timestamped orientations of the IMU. The knots are kept as a structure of arrays (one array
+// per quaternion coefficient) so that batch queries can be evaluated in vectorized loops.
+// Quaternions are (w, x, y, z) like in quaternions_datapacket.csv. Knot signs are chosen so
+// that consecutive knots lie on the same hemisphere, which makes every segment the shortest arc.
+class PoseTrajectory
+{
+public:
+    enum Interpolation { SLERP, SQUAD };
+
+    explicit PoseTrajectory(Interpolation interpolation = SLERP);
+
+    // The IMU is polled once per datapacket and repeats its last reading until a new one is
+    // available. Only the first row of every run of equal readings becomes a knot.
+    explicit PoseTrajectory(const quart_vector_t &quaternions_time, Interpolation interpolation = SLERP);
+
+    // Knots must be added in increasing time order.
+    void
+    add(double time, const Eigen::Vector4d &quaternion);
+
+    std::size_t size() const { return t_.size(); }
+    bool        empty() const { return t_.empty(); }
+    double      start_time() const { return t_.front(); }
+    double      end_time() const { return t_.back(); }
+
+    // Orientation at a single time. Times outside the trajectory are clamped to its ends.
+    Eigen::Vector4d
+    at(double time) const;
+
+    // Orientations at a batch of times, written as separate w, x, y, z arrays. Each query costs
+    // O(log n); ascending query times reuse the previous segment and are found in O(1).
+    void
+    at(const double *times, std::size_t n, double *w, double *x, double *y, double *z) const;
+
+    void
+    at(const std::vector<double> &times, vector4d_t &quaternions) const;
+
+private:
+    std::size_t
+    segment(double time, std::size_t hint) const;
+
+    void
+    update_squad_controls(std::size_t i);
+
+    Interpolation interpolation_;
+
+    // Knots
+    std::vector<double> t_, w_, x_, y_, z_;
+
+    // Per segment i -> i+1: angle between the knots and 1 / sin(angle)
+    std::vector<double> theta_, inv_sin_theta_;
+
+    // Per knot squad control points
+    std::vector<double> sw_, sx_, sy_, sz_;
+};
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,186 @@
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/common/io.h>
+#include <pcl/features/normal_3d_omp.h>
+#include <pcl/filters/voxel_grid.h>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+#include "prepared_cloud.h"
+
+// Smallest eigenvalue of a regularized GICP covariance, the same as PCL's default
+constexpr double gicp_epsilon = 1e-3;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+PreparedCloud::PreparedCloud()
+    : prepared_size_{0},
+      normals_k_{0},
+      covariances_k_{0}
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+PreparedCloud::PreparedCloud(const cloud_t::Ptr &cloud)
+    : PreparedCloud()
+{
+    reset(cloud);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+PreparedCloud::reset(const cloud_t::Ptr &cloud)
+{
+    cloud_ = cloud;
+    invalidate();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+PreparedCloud::invalidate()
+{
+    prepared_size_ = size();
+    search_.reset();
+    normals_k_ = 0;
+    covariances_.reset();
+    covariances_k_ = 0;
+    voxels_.clear();
+    levels_.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+PreparedCloud::check()
+{
+    if (prepared_size_ != size()) {
+        invalidate();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+PreparedCloud::search_t::Ptr
+PreparedCloud::search()
+{
+    check();
+    if (!search_) {
+        search_.reset(new search_t);
+        search_->setInputCloud(cloud_);
+    }
+    return search_;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+PreparedCloud::estimate_normals(int k)
+{
+    check();
+    if (normals_k_ == k) {
+        return;
+    }
+    pcl::PointCloud<pcl::Normal>::Ptr normals(new pcl::PointCloud<pcl::Normal>);
+    pcl::NormalEstimationOMP<pcl::PointNormal, pcl::Normal> ne;
+    ne.setSearchMethod(search());
+    ne.setInputCloud(cloud_);
+    ne.setKSearch(k);
+    ne.compute(*normals);
+    pcl::concatenateFields<pcl::PointNormal, pcl::Normal, pcl::PointNormal>(*cloud_, *normals, *cloud_);
+    normals_k_ = k;
+
+    // The levels average the normals
+    levels_.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+PreparedCloud::covariances_ptr_t
+PreparedCloud::covariances(int k)
+{
+    check();
+    if (covariances_ && covariances_k_ == k) {
+        return covariances_;
+    }
+    const search_t::Ptr tree = search();
+    const long n = static_cast<long>(cloud_->size());
+    covariances_.reset(new covariances_t(n));
+    covariances_t &covariances = *covariances_;
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+        std::vector<int> index(k);
+        std::vector<float> distance_squared(k);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (long i = 0; i < n; ++i) {
+            const int found = tree->nearestKSearch(cloud_->points[i], k, index, distance_squared);
+            Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+            Eigen::Matrix3d outer = Eigen::Matrix3d::Zero();
+            for (int j = 0; j < found; ++j) {
+                const Eigen::Vector3d p = cloud_->points[index[j]].getVector3fMap().cast<double>();
+                mean += p;
+                outer += p * p.transpose();
+            }
+            if (found > 0) {
+                mean /= found;
+                outer = outer / found - mean * mean.transpose();
+            }
+
+            // Plane of the neighbourhood with unit spread and gicp_epsilon across
+            const Eigen::JacobiSVD<Eigen::Matrix3d> svd(outer, Eigen::ComputeFullU);
+            const Eigen::Vector3d values(1, 1, gicp_epsilon);
+            covariances[i] = svd.matrixU() * values.asDiagonal() * svd.matrixU().transpose();
+        }
+    }
+    covariances_k_ = k;
+    return covariances_;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+VoxelCovariances::ConstPtr
+PreparedCloud::voxels(float resolution)
+{
+    check();
+    VoxelCovariances::ConstPtr &voxels = voxels_[resolution];
+    if (!voxels) {
+        voxels = std::make_shared<VoxelCovariances>(*cloud_, resolution);
+    }
+    return voxels;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+PreparedCloud &
+PreparedCloud::level(float voxel_size)
+{
+    check();
+    if (voxel_size <= 0) {
+        return *this;
+    }
+    std::shared_ptr<PreparedCloud> &level = levels_[voxel_size];
+    if (level) {
+        return *level;
+    }
+
+    cloud_t::Ptr downsampled(new cloud_t);
+    pcl::VoxelGrid<pcl::PointNormal> voxel_grid;
+    voxel_grid.setInputCloud(cloud_);
+    voxel_grid.setLeafSize(voxel_size, voxel_size, voxel_size);
+    voxel_grid.filter(*downsampled);
+
+    // The voxel grid averages the normals
+    for (std::size_t i = 0; i < downsampled->size(); ++i) {
+        Eigen::Map<Eigen::Vector3f> normal = downsampled->points[i].getNormalVector3fMap();
+        const float norm = normal.norm();
+        if (norm > 0) {
+            normal /= norm;
+        }
+    }
+    level.reset(new PreparedCloud(downsampled));
+    return *level;
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
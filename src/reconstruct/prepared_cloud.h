@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <memory>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/search/kdtree.h>
+#include <pcl/registration/gicp.h>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+#include "vgicp.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// A cloud together with what the registrations derive from it: the search tree, the normals, the
+// GICP covariances, the VGICP voxels and the downsampled pyramid levels. Each is computed on first use and kept until
+// the cloud changes, so a cloud that is aligned several times is preprocessed once. A different
+// size is detected as a change, after changing the points in place call invalidate(). Everything
+// that is computed on first use modifies the object, once computed it may be shared by threads.
+class PreparedCloud
+{
+public:
+    typedef pcl::PointCloud<pcl::PointNormal> cloud_t;
+    typedef pcl::search::KdTree<pcl::PointNormal> search_t;
+    typedef pcl::GeneralizedIterativeClosestPoint<pcl::PointNormal, pcl::PointNormal>::MatricesVector covariances_t;
+    typedef pcl::GeneralizedIterativeClosestPoint<pcl::PointNormal, pcl::PointNormal>::MatricesVectorPtr covariances_ptr_t;
+
+    PreparedCloud();
+
+    explicit PreparedCloud(const cloud_t::Ptr &cloud);
+
+    // Replaces the cloud and drops everything derived from the previous one
+    void
+    reset(const cloud_t::Ptr &cloud);
+
+    void
+    invalidate();
+
+    const cloud_t::Ptr &cloud() const { return cloud_; }
+    std::size_t         size() const { return cloud_ ? cloud_->size() : 0; }
+
+    // Kd-tree of the points
+    search_t::Ptr
+    search();
+
+    // Fills the normals of the cloud from its k nearest neighbours, once
+    void
+    estimate_normals(int k);
+
+    // GICP covariances from the k nearest neighbours, regularized to planes like PCL does
+    covariances_ptr_t
+    covariances(int k);
+
+    // Voxels with regularized covariances for VGICP, at voxel size `resolution`
+    VoxelCovariances::ConstPtr
+    voxels(float resolution);
+
+    // The cloud downsampled to voxel_size with renormalized normals, *this for voxel_size <= 0
+    PreparedCloud &
+    level(float voxel_size);
+
+private:
+    // Drops the derived data if the size of the cloud changed
+    void
+    check();
+
+    cloud_t::Ptr cloud_;
+    std::size_t prepared_size_;
+
+    search_t::Ptr search_;
+    int normals_k_;
+    covariances_ptr_t covariances_;
+    int covariances_k_;
+    std::map<float, VoxelCovariances::ConstPtr> voxels_;
+    std::map<float, std::shared_ptr<PreparedCloud> > levels_;
+};
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+#include "projective_icp.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ProjectiveICP::ProjectiveICP()
+    : transformation_epsilon_{0},
+      max_correspondence_distance_{0.5},
+      maximum_iterations_{10},
+      window_{4},
+      transformation_(Eigen::Matrix4f::Identity()),
+      converged_{false}
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+ProjectiveICP::setInputTarget(const RangeImage::ConstPtr &target)
+{
+    if (target != target_) {
+        target_ = target;
+        target_->normal_image(normal_x_, normal_y_, normal_z_);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+ProjectiveICP::setInputSource(const RangeImage::ConstPtr &source)
+{
+    source_.clear();
+    source_.reserve(source->size());
+    for (int row = 0; row < source->rows(); ++row) {
+        for (int column = 0; column < source->columns(); ++column) {
+            if (source->index(row, column) >= 0) {
+                source_.push_back(source->point(row, column));
+            }
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+NormalEquations
+ProjectiveICP::linearize(const Eigen::Matrix4f &transformation) const
+{
+    const Eigen::Matrix3f rotation = transformation.topLeftCorner<3, 3>();
+    const Eigen::Vector3f translation = transformation.col(3).head<3>();
+    const float max_distance_squared = static_cast<float>(max_correspondence_distance_ * max_correspondence_distance_);
+    const int rows = target_->rows();
+    const int columns = target_->columns();
+    const long n = static_cast<long>(source_.size());
+
+    NormalEquations system;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) reduction(+:system)
+#endif
+    for (long i = 0; i < n; ++i) {
+        const Eigen::Vector3f p = rotation * source_[i] + translation;
+        int row, column;
+        if (!target_->project(p, row, column)) {
+            continue;
+        }
+
+        // Closest target return with a normal around the projected pixel
+        float best = max_distance_squared;
+        std::size_t match = 0;
+        Eigen::Vector3f q;
+        bool found = false;
+        for (int r = std::max(row - 1, 0); r <= std::min(row + 1, rows - 1); ++r) {
+            for (int dc = -window_; dc <= window_; ++dc) {
+                const int c = (column + dc + columns) % columns;
+                if (target_->index(r, c) < 0) {
+                    continue;
+                }
+                const std::size_t pixel = static_cast<std::size_t>(r) * columns + c;
+                const Eigen::Vector3f t = target_->point(r, c);
+                const float distance = (t - p).squaredNorm();
+                if (distance < best && (normal_x_[pixel] != 0 || normal_y_[pixel] != 0 || normal_z_[pixel] != 0)) {
+                    best = distance;
+                    match = pixel;
+                    q = t;
+                    found = true;
+                }
+            }
+        }
+        if (!found) {
+            continue;
+        }
+
+        // A small motion (translation t, rotation r) changes the residual by n.t + (p x n).r
+        const Eigen::Vector3f normal(normal_x_[match], normal_y_[match], normal_z_[match]);
+        const double residual = (p - q).dot(normal);
+        Eigen::Matrix<double, 6, 1> J;
+        J.head<3>() = normal.cast<double>();
+        J.tail<3>() = p.cross(normal).cast<double>();
+        system.add(J, residual);
+    }
+    return system;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+ProjectiveICP::align(const Eigen::Matrix4f &guess)
+{
+    transformation_ = guess;
+    converged_ = false;
+    Convergence convergence(transformation_epsilon_);
+    for (int iteration = 0; iteration < maximum_iterations_; ++iteration) {
+        NormalEquations system = linearize(transformation_);
+        if (system.correspondences < 6) {
+            break;
+        }
+        add_prior(transformation_, system);
+        const Eigen::Matrix<double, 6, 1> delta = system.solve();
+        apply_left_step(delta, transformation_);
+        if (convergence.converged(delta)) {
+            converged_ = true;
+            break;
+        }
+    }
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
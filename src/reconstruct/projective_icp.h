@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+#include "gauss_newton.h"
+#include "range_image.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Point-to-plane ICP between two range images with projective data association: a source return is
+// projected into the target image and matched with the closest return within a few columns and
+// rings of that pixel, so an iteration is O(n) without any spatial index. The target normals come
+// from the image and are computed once per target. Meant for consecutive odometry scans, which are
+// only a few centimetres apart; larger motions need a good initial guess. A prior on the
+// transformation can be set, see PosePrior.
+class ProjectiveICP : public PosePrior
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    ProjectiveICP();
+
+    void setTransformationEpsilon(double epsilon) { transformation_epsilon_ = epsilon; }
+    void setMaxCorrespondenceDistance(double distance) { max_correspondence_distance_ = distance; }
+    void setMaximumIterations(int iterations) { maximum_iterations_ = iterations; }
+
+    // Columns searched on each side of the projected pixel, the rings above and below are searched too
+    void setSearchWindow(int columns) { window_ = columns; }
+
+    void
+    setInputTarget(const RangeImage::ConstPtr &target);
+
+    void
+    setInputSource(const RangeImage::ConstPtr &source);
+
+    // Aligns the source with the target starting from guess
+    void
+    align(const Eigen::Matrix4f &guess = Eigen::Matrix4f::Identity());
+
+    Eigen::Matrix4f getFinalTransformation() const { return transformation_; }
+    bool            hasConverged() const { return converged_; }
+
+private:
+    // Gauss-Newton system of the correspondences at `transformation`
+    NormalEquations
+    linearize(const Eigen::Matrix4f &transformation) const;
+
+    double transformation_epsilon_;
+    double max_correspondence_distance_;
+    int maximum_iterations_;
+    int window_;
+
+    RangeImage::ConstPtr target_;
+    std::vector<float> normal_x_;
+    std::vector<float> normal_y_;
+    std::vector<float> normal_z_;
+
+    // Source returns
+    std::vector<Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f> > source_;
+
+    Eigen::Matrix4f transformation_;
+    bool converged_;
+};
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1,18 +0,0 @@
-#pragma once
-
-#include <utility>
-#include <vector>
-
-#if defined __GNUC__ || defined __APPLE__
-#include <Eigen/Dense>
-#else
-#include <eigen3/Eigen/Dense>
-#endif
-
-#include "reco_types.h"
-
-//////////////////////////////////////////////////////////////////////////////////////////////////////////////
-void
-interpolate_quaternions( vector4d_t& interpolated_quaternions,
-                         const quart_vector_t& quaternions_time );
-//////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+#include "range_image.h"
+
+// Two returns are on the same surface if their ranges differ by less than this fraction. Neighbouring
+// rings are 2 degrees apart, which on the floor already changes the range by up to a quarter.
+constexpr float surface_jump = 0.3f;
+
+// Returns of two images that must overlap to compare them
+constexpr std::size_t min_overlap = 1000;
+
+// Lowest and highest vertical angle of the VLP-16 lasers in degrees, 2 degrees apart
+constexpr int lowest_ring_angle = -15;
+constexpr int highest_ring_angle = 15;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Branch free, empty pixels have infinite range and never match
+static inline float
+same_surface(float range, float neighbour_range)
+{
+    return std::abs(neighbour_range - range) <= surface_jump * range ? 1.0f : 0.0f;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+RangeImage::RangeImage(int columns)
+    : columns_{columns},
+      valid_{0},
+      sensor_pose_(Eigen::Matrix4f::Identity())
+{
+    clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+RangeImage::clear()
+{
+    const std::size_t pixels = static_cast<std::size_t>(rings) * columns_;
+    x_.assign(pixels, 0.0f);
+    y_.assign(pixels, 0.0f);
+    z_.assign(pixels, 0.0f);
+    range_.assign(pixels, std::numeric_limits<float>::infinity());
+    index_.assign(pixels, -1);
+    valid_ = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+RangeImage::erase(std::size_t pixel)
+{
+    if (index_[pixel] >= 0) {
+        x_[pixel] = y_[pixel] = z_[pixel] = 0.0f;
+        range_[pixel] = std::numeric_limits<float>::infinity();
+        index_[pixel] = -1;
+        --valid_;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int
+RangeImage::column(float x, float y) const
+{
+    // x = d cos(v) sin(azimuth), y = d cos(v) cos(azimuth) in the sensor frame
+    const float azimuth = std::atan2(x, y);
+    const int column = static_cast<int>((azimuth + static_cast<float>(M_PI)) / static_cast<float>(2 * M_PI) * columns_);
+    return std::min(std::max(column, 0), columns_ - 1);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool
+RangeImage::insert(const PointXYZLT &raw, const Eigen::Vector3f &point, std::int32_t index)
+{
+    // The label is the vertical angle of the laser, negative angles wrapped around
+    const std::int32_t vertical = static_cast<std::int32_t>(raw.label);
+    if (vertical < lowest_ring_angle || vertical > highest_ring_angle || (vertical - lowest_ring_angle) % 2 != 0) {
+        return false;
+    }
+    const int row = (vertical - lowest_ring_angle) / 2;
+
+    const std::size_t pixel = static_cast<std::size_t>(row) * columns_ + column(raw.x, raw.y);
+    if (index_[pixel] < 0) {
+        ++valid_;
+    }
+    x_[pixel] = point.x();
+    y_[pixel] = point.y();
+    z_[pixel] = point.z();
+    range_[pixel] = std::sqrt(raw.x * raw.x + raw.y * raw.y + raw.z * raw.z);
+    index_[pixel] = index;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool
+RangeImage::project(const Eigen::Vector3f &point, int &row, int &column) const
+{
+    const Eigen::Vector3f p = sensor_pose_.topLeftCorner<3, 3>().transpose() * (point - sensor_pose_.col(3).head<3>());
+    const float vertical = std::atan2(p.z(), std::sqrt(p.x() * p.x() + p.y() * p.y())) * static_cast<float>(180 / M_PI);
+    row = static_cast<int>(std::floor((vertical - lowest_ring_angle) / 2 + 0.5f));
+    if (row < 0 || row >= rings) {
+        return false;
+    }
+    column = this->column(p.x(), p.y());
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+float
+RangeImage::displacement(const RangeImage &other) const
+{
+    const Eigen::Vector3f origin = sensor_pose_.col(3).head<3>();
+    std::vector<float> changes;
+    changes.reserve(other.valid_);
+    for (std::size_t pixel = 0; pixel < other.range_.size(); ++pixel) {
+        if (other.index_[pixel] < 0) {
+            continue;
+        }
+        const Eigen::Vector3f p(other.x_[pixel], other.y_[pixel], other.z_[pixel]);
+        int row, column;
+        if (!project(p, row, column)) {
+            continue;
+        }
+        const float r = range(row, column);
+        if (std::isfinite(r)) {
+            changes.push_back(std::abs((p - origin).norm() - r));
+        }
+    }
+    if (changes.size() < min_overlap) {
+        return std::numeric_limits<float>::infinity();
+    }
+    std::nth_element(changes.begin(), changes.begin() + changes.size() / 2, changes.end());
+    return changes[changes.size() / 2];
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+RangeImage::remove_outliers(int min_neighbours)
+{
+    std::vector<std::size_t> outliers;
+    for (int row = 0; row < rings; ++row) {
+        const int up = row > 0 ? row - 1 : row;
+        const int down = row < rings - 1 ? row + 1 : row;
+        for (int column = 0; column < columns_; ++column) {
+            const std::size_t pixel = static_cast<std::size_t>(row) * columns_ + column;
+            if (index_[pixel] < 0) {
+                continue;
+            }
+            const int left = column > 0 ? column - 1 : columns_ - 1;
+            const int right = column < columns_ - 1 ? column + 1 : 0;
+            const float r = range_[pixel];
+            float neighbours = same_surface(r, range_[static_cast<std::size_t>(row) * columns_ + left])
+                             + same_surface(r, range_[static_cast<std::size_t>(row) * columns_ + right]);
+            if (up != row) {
+                neighbours += same_surface(r, range_[static_cast<std::size_t>(up) * columns_ + column]);
+            }
+            if (down != row) {
+                neighbours += same_surface(r, range_[static_cast<std::size_t>(down) * columns_ + column]);
+            }
+            if (neighbours < min_neighbours) {
+                outliers.push_back(pixel);
+            }
+        }
+    }
+
+    // Removed after the search, so the outliers do not depend on the order of the pixels
+    for (std::size_t i = 0; i < outliers.size(); ++i) {
+        erase(outliers[i]);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Normal of `pixel` from its horizontal neighbours at left/right and vertical neighbours at up/down.
+// A neighbour on another surface is replaced by the pixel itself, so the difference becomes one
+// sided, and both missing make the normal zero. Oriented towards the sensor at the origin.
+static inline void
+pixel_normal(const float *x, const float *y, const float *z, const float *range,
+             std::size_t pixel, std::size_t left, std::size_t right, std::size_t up, std::size_t down,
+             float &nx, float &ny, float &nz)
+{
+    const float r = range[pixel];
+    const float wl = same_surface(r, range[left]);
+    const float wr = same_surface(r, range[right]);
+    const float wu = same_surface(r, range[up]);
+    const float wd = same_surface(r, range[down]);
+
+    const float hx = (wr * x[right] + (1 - wr) * x[pixel]) - (wl * x[left] + (1 - wl) * x[pixel]);
+    const float hy = (wr * y[right] + (1 - wr) * y[pixel]) - (wl * y[left] + (1 - wl) * y[pixel]);
+    const float hz = (wr * z[right] + (1 - wr) * z[pixel]) - (wl * z[left] + (1 - wl) * z[pixel]);
+    const float vx = (wd * x[down] + (1 - wd) * x[pixel]) - (wu * x[up] + (1 - wu) * x[pixel]);
+    const float vy = (wd * y[down] + (1 - wd) * y[pixel]) - (wu * y[up] + (1 - wu) * y[pixel]);
+    const float vz = (wd * z[down] + (1 - wd) * z[pixel]) - (wu * z[up] + (1 - wu) * z[pixel]);
+
+    const float cx = hy * vz - hz * vy;
+    const float cy = hz * vx - hx * vz;
+    const float cz = hx * vy - hy * vx;
+    const float norm = std::sqrt(cx * cx + cy * cy + cz * cz);
+    const float facing = cx * x[pixel] + cy * y[pixel] + cz * z[pixel] > 0 ? -1.0f : 1.0f;
+    const float scale = norm > 0 ? facing / norm : 0.0f;
+    nx = cx * scale;
+    ny = cy * scale;
+    nz = cz * scale;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+RangeImage::normal_image(std::vector<float> &nx, std::vector<float> &ny, std::vector<float> &nz) const
+{
+    const std::size_t pixels = range_.size();
+    nx.resize(pixels);
+    ny.resize(pixels);
+    nz.resize(pixels);
+    const float *x = x_.data();
+    const float *y = y_.data();
+    const float *z = z_.data();
+    const float *range = range_.data();
+
+    for (int row = 0; row < rings; ++row) {
+        const std::size_t first = static_cast<std::size_t>(row) * columns_;
+        const std::size_t up = static_cast<std::size_t>(row > 0 ? row - 1 : row) * columns_;
+        const std::size_t down = static_cast<std::size_t>(row < rings - 1 ? row + 1 : row) * columns_;
+
+        // The azimuth wraps around at the first and last column, the columns between vectorize
+        pixel_normal(x, y, z, range, first, first + columns_ - 1, first + 1, up, down,
+                     nx[first], ny[first], nz[first]);
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+        for (int column = 1; column < columns_ - 1; ++column) {
+            const std::size_t pixel = first + column;
+            pixel_normal(x, y, z, range, pixel, pixel - 1, pixel + 1, up + column, down + column,
+                         nx[pixel], ny[pixel], nz[pixel]);
+        }
+        const std::size_t last = first + columns_ - 1;
+        pixel_normal(x, y, z, range, last, last - 1, first, up + columns_ - 1, down + columns_ - 1,
+                     nx[last], ny[last], nz[last]);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+RangeImage::normals(pcl::PointCloud<pcl::PointNormal> &cloud, float voxel_size) const
+{
+    std::vector<float> nx, ny, nz;
+    normal_image(nx, ny, nz);
+
+    const float voxel_size_squared = voxel_size * voxel_size;
+    cloud.clear();
+    cloud.reserve(valid_);
+    for (int row = 0; row < rings; ++row) {
+        std::size_t kept = 0;
+        bool any = false;
+        for (int column = 0; column < columns_; ++column) {
+            const std::size_t pixel = static_cast<std::size_t>(row) * columns_ + column;
+            if (index_[pixel] < 0 || (nx[pixel] == 0 && ny[pixel] == 0 && nz[pixel] == 0)) {
+                continue;
+            }
+            if (voxel_size > 0 && any) {
+                const float dx = x_[pixel] - x_[kept];
+                const float dy = y_[pixel] - y_[kept];
+                const float dz = z_[pixel] - z_[kept];
+                if (dx * dx + dy * dy + dz * dz < voxel_size_squared && same_surface(range_[kept], range_[pixel]) > 0) {
+                    continue;
+                }
+            }
+            kept = pixel;
+            any = true;
+
+            pcl::PointNormal p;
+            p.x = x_[pixel];
+            p.y = y_[pixel];
+            p.z = z_[pixel];
+            p.normal_x = nx[pixel];
+            p.normal_y = ny[pixel];
+            p.normal_z = nz[pixel];
+            p.curvature = 0;
+            cloud.push_back(p);
+        }
+    }
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+#include "reco_types.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Organized view of a VLP-16 scan: one row per laser ring, sorted by elevation, and one column per
+// azimuth step, so the neighbours of a return are found in O(1). A pixel keeps the registered
+// position of its return and its index in the scan. The ring is decoded from the point label, which
+// holds the vertical angle of the laser in degrees, and the column from the azimuth of the return
+// in the sensor frame. Returns of the same pixel keep the last one.
+class RangeImage
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    typedef std::shared_ptr<RangeImage> Ptr;
+    typedef std::shared_ptr<const RangeImage> ConstPtr;
+
+    static constexpr int rings = 16;
+
+    // 0.2 degrees, the azimuth resolution of the VLP-16 at 600 rpm
+    static constexpr int default_columns = 1800;
+
+    explicit RangeImage(int columns = default_columns);
+
+    int         rows() const { return rings; }
+    int         columns() const { return columns_; }
+    std::size_t size() const { return valid_; }
+
+    void
+    clear();
+
+    // Places point `index` of the scan, `point` is its registered position and `raw` the return in
+    // the sensor frame. Returns false if the label is not a VLP-16 ring.
+    bool
+    insert(const PointXYZLT &raw, const Eigen::Vector3f &point, std::int32_t index);
+
+    // Index in the scan of the return at (row, column), -1 if the pixel is empty
+    std::int32_t index(int row, int column) const { return index_[row * columns_ + column]; }
+
+    // Range of the return at (row, column), infinite if the pixel is empty
+    float range(int row, int column) const { return range_[row * columns_ + column]; }
+
+    Eigen::Vector3f
+    point(int row, int column) const
+    {
+        const std::size_t pixel = static_cast<std::size_t>(row) * columns_ + column;
+        return Eigen::Vector3f(x_[pixel], y_[pixel], z_[pixel]);
+    }
+
+    // Transformation from the sensor frame to the registered frame of the returns, at the middle of
+    // the scan. Defaults to the identity.
+    void
+    set_sensor_pose(const Eigen::Matrix4f &pose) { sensor_pose_ = pose; }
+
+    const Eigen::Matrix4f &sensor_pose() const { return sensor_pose_; }
+
+    // Pixel in which the sensor would see a point given in the registered frame. Returns false
+    // outside of the vertical field of view. Within a scan the sensor turns with the operator, so
+    // the pixel is only accurate to a few columns.
+    bool
+    project(const Eigen::Vector3f &point, int &row, int &column) const;
+
+    // How far the returns of `other` moved relative to this image: the median change of range of its
+    // returns projected into this image and seen from its sensor. Infinite if too few returns
+    // overlap. Rotations of the sensor do not change it, so it measures translation only.
+    float
+    displacement(const RangeImage &other) const;
+
+    // Empties the pixels with fewer than min_neighbours returns among their horizontal and vertical
+    // neighbours on the same surface: isolated returns from dust, glass and mixed edge pixels
+    void
+    remove_outliers(int min_neighbours = 2);
+
+    // The returns with their normals, from the cross product of the horizontal and the vertical
+    // central differences in the image. Returns without neighbours on the same surface in both
+    // directions get no normal and are left out. With voxel_size > 0 about one return per voxel_size
+    // along every ring is exported: a return is kept when it is at least voxel_size from the last
+    // kept return of its ring or on a different surface. The rings themselves are already further
+    // apart than useful voxel sizes, and the normals still come from all returns.
+    void
+    normals(pcl::PointCloud<pcl::PointNormal> &cloud, float voxel_size = 0) const;
+
+    // The normals of all pixels as a structure of arrays, row major, zero where there is none
+    void
+    normal_image(std::vector<float> &nx, std::vector<float> &ny, std::vector<float> &nz) const;
+
+private:
+    void
+    erase(std::size_t pixel);
+
+    // Column of a direction in the sensor frame
+    int
+    column(float x, float y) const;
+
+    int columns_;
+    std::size_t valid_;
+
+    // Structure of arrays, row major. Empty pixels are at the origin with infinite range and index -1,
+    // so the kernels need no branches.
+    std::vector<float> x_;
+    std::vector<float> y_;
+    std::vector<float> z_;
+    std::vector<float> range_;
+    std::vector<std::int32_t> index_;
+
+    Eigen::Matrix4f sensor_pose_;
+};
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -3,6 +3,8 @@
 #include <vector>
 
 #include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/register_point_struct.h>
 
 #if defined __GNUC__ || defined __APPLE__
 #include <Eigen/Dense>
@@ -17,3 +19,21 @@ typedef std::pair<std::vector<Eigen::Vector4d,
 typedef std::vector<Eigen::Vector4d,
                     Eigen::aligned_allocator<Eigen::Vector4d> > vector4d_t;
 
+// Datapacket point: PointXYZL with the firing time of the return in microseconds, relative to
+// the datapacket timestamp in quaternions_datapacket.csv. Captures recorded before the time field
+// was added load with time 0. Translation units using this type define PCL_NO_PRECOMPILE.
+struct EIGEN_ALIGN16 PointXYZLT
+{
+    PCL_ADD_POINT4D;
+    std::uint32_t label;
+    float time;
+    PCL_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+POINT_CLOUD_REGISTER_POINT_STRUCT(PointXYZLT,
+                                  (float, x, x)
+                                  (float, y, y)
+                                  (float, z, z)
+                                  (std::uint32_t, label, label)
+                                  (float, time, time))
+
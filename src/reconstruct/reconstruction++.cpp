@@ -1,5 +1,14 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -14,15 +23,224 @@
 
 #include <boost/filesystem.hpp>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 // #include "cmd_line_parser.h"
+#include "fragment_source.h"
 #include "load_data.h"
-#include "quaternion_interpolation.h"
+#include "pose_trajectory.h"
 #include "combine_datapackets.h"
 #include "registration_estimation.h"
 #include "cmdline.h"
+#include "task_graph.h"
+#include "transformation.h"
+#include "thread_pool.h"
+
+typedef pcl::PointCloud<PointXYZLT> point_cloud_w_labels;
+
+// Peak memory of a fragment relative to the size of its datapacket files: the loaded datapackets
+// plus the combined fragment
+constexpr std::size_t fragment_memory_factor = 3;
+
+// Memory of the pairwise registration relative to the size of the fragment files: preparing a
+// fragment holds its points with normals and their search tree, a pair the samples of both
+// fragments with their search trees and covariances
+constexpr std::size_t registration_memory_factor = 4;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Runs a function when the scope is left, also by an exception
+class ScopeExit
+{
+public:
+    explicit ScopeExit(std::function<void()> function) : function_(std::move(function)) {}
+    ~ScopeExit() { function_(); }
+
+    ScopeExit(const ScopeExit &) = delete;
+    ScopeExit &operator=(const ScopeExit &) = delete;
+
+private:
+    std::function<void()> function_;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static int
+hardware_threads()
+{
+#ifdef _OPENMP
+    return omp_get_num_procs();
+#else
+    return static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Limits the OpenMP teams started from this thread to `threads` until the end of the scope. The
+// limit is a setting of the calling thread, without the restore it would stay on the pool worker
+// and shrink the teams of every later task that runs there.
+class OmpThreadLimit
+{
+public:
+    explicit OmpThreadLimit(int threads)
+#ifdef _OPENMP
+        : previous_{omp_get_max_threads()}
+    {
+        omp_set_num_threads(std::max(1, threads));
+    }
+    ~OmpThreadLimit() { omp_set_num_threads(previous_); }
+#else
+    {}
+#endif
+
+    OmpThreadLimit(const OmpThreadLimit &) = delete;
+    OmpThreadLimit &operator=(const OmpThreadLimit &) = delete;
+
+#ifdef _OPENMP
+private:
+    int previous_;
+#endif
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Combines the datapackets of one fragment. Runs on a pool thread, progress goes to `log` so that
+// the output of concurrent fragments is not interleaved.
+void
+process_fragment(const std::string &fragment_path,
+                 const PoseTrajectory::Interpolation interpolation,
+                 const bool deskew,
+                 const bool level,
+                 const unsigned concurrent_fragments,
+                 std::ostream &log)
+{
+    // Share the cores between the fragments running concurrently
+    const OmpThreadLimit omp_threads(hardware_threads() / static_cast<int>(concurrent_fragments));
+
+    // Read quaternions
+    log << "Reading quaternions file...";
+    quart_vector_t quaternions_time;
+    read_quaternions_file( quaternions_time, fragment_path + "/quaternions" );
+    log << "Done." << std::endl;
+
+    // Level with the recorded gravity
+    Eigen::Matrix3d leveling = Eigen::Matrix3d::Identity();
+    if (level) {
+        std::vector<Eigen::Vector3d> gravity;
+        read_gravity_file( gravity, fragment_path + "/quaternions" );
+        make_leveling_rotation(quaternions_time.first, gravity, leveling);
+    }
+
+    // Interpolate quaternions
+    log << "Interpolating quaternions...";
+    const PoseTrajectory trajectory(quaternions_time, interpolation);
+    log << "Done." << std::endl;
+
+    // Load datapackets
+    log << "Loading datapackets..." << std::endl;
+    std::vector<std::vector<point_cloud_w_labels> >
+        datapackets_clouds = load_datapackets(fragment_path + "/datapackets");
+    log << "Done." << std::endl;
 
-typedef pcl::PointCloud<pcl::PointXYZ> point_cloud;
-typedef pcl::PointCloud<pcl::PointXYZL> point_cloud_w_labels;
+    // Combine datapackets to fragment
+    log << "Combining datapackets to fragment...";
+    combine_datapackets_to_fragment(datapackets_clouds,
+                                    trajectory,
+                                    quaternions_time.second,
+                                    deskew,
+                                    fragment_path,
+                                    leveling.cast<float>());
+    log << "Done." << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Estimates the translation over one odometry run. Scan combination and translation estimation
+// stay one task: the scans are streamed from a producer thread into the estimation, so neither
+// half holds all scans in memory.
+void
+process_odometry(const std::string &odometry_path,
+                 const PoseTrajectory::Interpolation interpolation,
+                 const bool deskew,
+                 const bool save_scans,
+                 const bool compose,
+                 const OdometryMethod method,
+                 const bool level,
+                 const bool imu_prior,
+                 const float keyframe_distance,
+                 const unsigned concurrent_tasks,
+                 Eigen::Vector3f &translation,
+                 std::ostream &log)
+{
+    const OmpThreadLimit omp_threads(hardware_threads() / static_cast<int>(concurrent_tasks));
+
+    // Read quaternions
+    log << "Reading quaternions file...";
+    quart_vector_t quaternions_time;
+    read_quaternions_file( quaternions_time, odometry_path + "/quaternions" );
+    log << "Done." << std::endl;
+
+    // Interpolate quaternions
+    log << "Interpolating quaternions...";
+    const PoseTrajectory trajectory(quaternions_time, interpolation);
+    log << "Done." << std::endl;
+
+    // Read IMU rates for the motion priors
+    imu_vector_t imu;
+    if (imu_prior) {
+        log << "Reading IMU data...";
+        read_imu_file( imu, odometry_path + "/imu" );
+        log << "Done." << std::endl;
+    }
+
+    // Load datapackets
+    log << "Loading datapackets..." << std::endl;
+    std::vector<std::vector<point_cloud_w_labels> >
+        datapacket_clouds = load_datapackets(odometry_path + "/datapackets");
+    log << "Done." << std::endl;
+
+    // Combine datapackets to scans and estimate the translation while the scans arrive
+    log << "Combining datapackets to scans and estimating translation...";
+    ScanStream scans(scan_stream_capacity);
+    KeyframeSelector keyframes(scans, keyframe_distance);
+    std::exception_ptr combine_error;
+    std::thread combine_thread([&]() {
+        // The stream is closed however the producer ends, so the estimation never waits forever
+        ScopeExit close_scans([&keyframes]() { keyframes.close(); });
+        try {
+            combine_datapackets_to_scans(datapacket_clouds,
+                                         trajectory,
+                                         quaternions_time.second,
+                                         imu,
+                                         deskew,
+                                         keyframes,
+                                         save_scans ? odometry_path : "");
+        } catch (...) {
+            combine_error = std::current_exception();
+        }
+    });
+    {
+        // If the estimation throws, the producer is stopped and joined before the exception leaves
+        ScopeExit join_combine([&scans, &combine_thread]() {
+            scans.close();
+            combine_thread.join();
+        });
+        translation = Eigen::Vector3f::Zero();
+        const unsigned threads = static_cast<unsigned>(std::max(1, hardware_threads() / static_cast<int>(concurrent_tasks)));
+        translation_estimation(scans, translation, compose, threads, method);
+    }
+    if (combine_error) {
+        std::rethrow_exception(combine_error);
+    }
+    log << "Done. Registered " << keyframes.keyframes() << " of " << keyframes.scans() << " scans." << std::endl;
+
+    // Into the leveled frame of the fragments
+    if (level) {
+        std::vector<Eigen::Vector3d> gravity;
+        read_gravity_file( gravity, odometry_path + "/quaternions" );
+        Eigen::Matrix3d leveling;
+        make_leveling_rotation(quaternions_time.first, gravity, leveling);
+        translation = leveling.cast<float>() * translation;
+    }
+}
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -34,96 +252,180 @@ main(int argc, char **argv)
     const std::string &data_dir = cmdline.getDataDir(); // argv[1];
     bool visualization = cmdline.getVisualize(); // false;
     // if (argc > 2) {std::string arg = argv[2]; if (arg == "v") {visualization = true;}}
+    const PoseTrajectory::Interpolation interpolation =
+        cmdline.getInterpolation() == "squad" ? PoseTrajectory::SQUAD : PoseTrajectory::SLERP;
+    const OdometryMethod odometry_method = cmdline.getOdometry() == "projective" ? PROJECTIVE_ODOMETRY
+                                         : cmdline.getOdometry() == "loam"       ? FEATURE_ODOMETRY
+                                                                                 : ICP_ODOMETRY;
 
-    //////////////////////////////////// Fragments ///////////////////////////////////////////////////
-    std::cout << std::endl << "Fragments" << std::endl << std::endl;
-    int fragments = number_of_directories(data_dir + "/fragments");
+    // The gravity constrained registration needs leveled fragments and translations
+    const bool level = cmdline.getICPType() == "gravity" || cmdline.getICPType() == "gravity-refined";
 
+    const int fragments = number_of_directories(data_dir + "/fragments");
+    const bool odometry = boost::filesystem::exists(data_dir + "/odometry");
+    const int odometries = odometry ? number_of_directories(data_dir + "/odometry") : 0;
+    std::vector<Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f> > translations(odometries);
+
+    // The registration windows block the thread they were opened on, so with visualization the
+    // incremental registration runs on the main thread after the graph
+    const bool pairwise = cmdline.getRegistration() == "pairwise";
+    const bool registration_in_graph = odometry && (pairwise || !visualization) && fragments > 0;
+    const int registered_fragments = std::min(fragments, odometries + 1);
+
+    //////////////////////////////////// Task graph ///////////////////////////////////////////////////
+    // fragment i         : combines the datapackets of fragment i
+    // odometry i         : combines the scans of odometry i and estimates its translation
+    // registration i     : aligns the map with fragment i, needs fragments i - 1, i, translation i - 1
+    //                      and registration i - 1
+    // prepare i          : pairwise mode, loads fragment i and prepares its sample for both its pairs
+    // pair i             : pairwise mode, registers fragment i - 1 with fragment i, needs prepared
+    //                      fragments i - 1, i and translation i - 1 only, so all pairs run concurrently
+    ThreadPool pool(cmdline.getJobs());
+    MemoryBudget memory(cmdline.getMemoryLimit());
+    std::mutex log_mutex;
+    TaskGraph graph;
+
+    std::vector<TaskGraph::node_t> fragment_nodes;
+    std::unique_ptr<std::atomic<bool>[]> fragment_ready(new std::atomic<bool>[std::max(fragments, 1)]);
     for (int i = 0; i < fragments; ++i) {
-        std::cout << i << std::endl;
-        std::string fragment = "fragment_" + std::to_string(i);
-
-        // Read quaternions
-        std::cout << "Reading quaternions file..."<< std::flush;
-        quart_vector_t quaternions_time;
-        read_quaternions_file( quaternions_time,
-                               data_dir + "/fragments/" + fragment + "/quaternions" );
-        std::cout << "Done." << std::endl;
-
-        // Interpolate quaternions
-        std::cout << "Interpolating quaternions..."<< std::flush;
-        vector4d_t interpolated_quaternions;
-        interpolate_quaternions( interpolated_quaternions, quaternions_time );
-        std::cout << "Done." << std::endl;
-
-        // Load datapackets
-        std::cout << "Loading datapackets..."<< std::endl;
-        std::vector<std::vector<point_cloud_w_labels> >
-            datapackets_clouds = load_datapackets(data_dir + "/fragments/" + fragment + "/datapackets");
-        std::cout << "Done." << std::endl;
-
-        // Combine datapackets to fragment
-        std::cout << "Combining datapackets to fragment..."<< std::flush;
-        combine_datapackets_to_fragment(datapackets_clouds,
-                                        interpolated_quaternions,
-                                        data_dir + "/fragments/" + fragment);
-        std::cout << "Done." << std::endl;
+        fragment_ready[i] = false;
+        fragment_nodes.push_back(graph.add("fragment " + std::to_string(i), [&, i]() {
+            const std::string fragment_path = data_dir + "/fragments/fragment_" + std::to_string(i);
+            std::ostringstream log;
+            log << "Fragment " << i << std::endl;
+            {
+                MemoryReservation reservation(memory, fragment_memory_factor * datapackets_size(fragment_path + "/datapackets"));
+                process_fragment(fragment_path, interpolation, cmdline.getDeskew(), level, pool.size(), log);
+            }
+            fragment_ready[i] = true;
+            std::lock_guard<std::mutex> lock(log_mutex);
+            std::cout << log.str() << std::flush;
+        }));
+    }
+
+    std::vector<TaskGraph::node_t> odometry_nodes;
+    for (int i = 0; i < odometries; ++i) {
+        odometry_nodes.push_back(graph.add("odometry " + std::to_string(i), [&, i]() {
+            const std::string odometry_path = data_dir + "/odometry/odometry_" + std::to_string(i);
+            std::ostringstream log;
+            log << "Odometry " << i << std::endl;
+            {
+                MemoryReservation reservation(memory, fragment_memory_factor * datapackets_size(odometry_path + "/datapackets"));
+                process_odometry(odometry_path, interpolation, cmdline.getDeskew(), cmdline.getSaveScans(),
+                                 cmdline.getComposeOdometry(), odometry_method, level, cmdline.getImuPrior(),
+                                 cmdline.getKeyframeDistance(), pool.size(), translations[i], log);
+            }
+            std::lock_guard<std::mutex> lock(log_mutex);
+            std::cout << log.str() << std::flush;
+        }));
+    }
+
+    FragmentSource fragment_source(data_dir + "/fragments", fragments);
+    IncrementalRegistration registration(cmdline.getICPType(), visualization,
+                                         cmdline.getSubmapFragments(), cmdline.getSubmapRadius(),
+                                         cmdline.getMapResolution());
+    const std::vector<PyramidLevel> pyramid = cmdline.getPyramid() ? Registration::default_pyramid()
+                                                                   : std::vector<PyramidLevel>();
+    registration.set_pyramid(pyramid);
+    registration.set_coarse_alignment(cmdline.getCoarseAlignment());
+    std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f> > pair_steps(registered_fragments);
+    std::vector<PoseGraph::information_t, Eigen::aligned_allocator<PoseGraph::information_t> >
+        pair_informations(registered_fragments);
+    if (registration_in_graph && pairwise) {
+        // A prepared fragment is released by the second of its two pairs
+        std::shared_ptr<std::vector<PairwiseFragment::Ptr> > prepared(new std::vector<PairwiseFragment::Ptr>(registered_fragments));
+        std::shared_ptr<std::vector<int> > users(new std::vector<int>(registered_fragments, 2));
+        users->front() = users->back() = 1;
+        std::shared_ptr<std::mutex> prepared_mutex(new std::mutex);
+
+        std::vector<TaskGraph::node_t> prepare_nodes;
+        for (int i = 0; i < registered_fragments; ++i) {
+            prepare_nodes.push_back(graph.add("prepare " + std::to_string(i), [&, i, prepared]() {
+                const OmpThreadLimit omp_threads(hardware_threads() / static_cast<int>(pool.size()));
+                MemoryReservation reservation(memory, registration_memory_factor * fragment_source.file_size(i));
+
+                PairwiseFragment::Ptr fragment = std::make_shared<PairwiseFragment>();
+                prepare_pairwise_fragment(cmdline.getICPType(), *fragment_source.load(i), *fragment, cmdline.getCoarseAlignment());
+                (*prepared)[i] = fragment;
+            }, {fragment_nodes[i]}));
+        }
+        for (int i = 1; i < registered_fragments; ++i) {
+            graph.add("pair " + std::to_string(i), [&, i, prepared, users, prepared_mutex]() {
+                const OmpThreadLimit omp_threads(hardware_threads() / static_cast<int>(pool.size()));
+                MemoryReservation reservation(memory, registration_memory_factor
+                                                      * (fragment_source.file_size(i - 1) + fragment_source.file_size(i)));
+                PairwiseFragment::Ptr previous;
+                PairwiseFragment::Ptr fragment;
+                {
+                    std::lock_guard<std::mutex> lock(*prepared_mutex);
+                    previous = (*prepared)[i - 1];
+                    fragment = (*prepared)[i];
+                    if (--(*users)[i - 1] == 0) {
+                        (*prepared)[i - 1].reset();
+                    }
+                    if (--(*users)[i] == 0) {
+                        (*prepared)[i].reset();
+                    }
+                }
+                pairwise_registration(cmdline.getICPType(), *previous, *fragment, translations[i - 1],
+                                      pair_steps[i], pair_informations[i], pyramid, cmdline.getCoarseAlignment());
+                std::lock_guard<std::mutex> lock(log_mutex);
+                std::cout << "Registered fragments " << i - 1 << " and " << i << std::endl;
+            }, {prepare_nodes[i - 1], prepare_nodes[i], odometry_nodes[i - 1]});
+        }
+    } else if (registration_in_graph) {
+        // Fragment i + 1 is only prefetched when it has already been combined
+        TaskGraph::node_t previous = graph.add("registration 0", [&]() {
+            const OmpThreadLimit omp_threads(hardware_threads() / static_cast<int>(pool.size()));
+            registration.add(fragment_source.get(0, fragments > 1 && fragment_ready[1]), Eigen::Vector3f::Zero());
+        }, {fragment_nodes[0]});
+        for (int i = 1; i < registered_fragments; ++i) {
+            previous = graph.add("registration " + std::to_string(i), [&, i]() {
+                const OmpThreadLimit omp_threads(hardware_threads() / static_cast<int>(pool.size()));
+                const bool prefetch = i + 1 < fragments && fragment_ready[i + 1];
+                registration.add(fragment_source.get(i, prefetch), translations[i - 1]);
+                std::lock_guard<std::mutex> lock(log_mutex);
+                std::cout << "Registered fragment " << i << std::endl;
+            }, {fragment_nodes[i - 1], fragment_nodes[i], odometry_nodes[i - 1], previous});
+        }
     }
 
+    graph.run(pool);
     std::cout << std::endl << std::endl;
 
-    //////////////////////////////////// Odometry ///////////////////////////////////////////////////////////
-    if (boost::filesystem::exists(data_dir + "/odometry")) {
-        std::cout << "Odometry" << std::endl << std::endl;
-        int odometries = number_of_directories(data_dir + "/odometry");
-        std::vector<Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f> > translations;
-        for (int i = 0; i < odometries; ++i) {
-            std::cout << i << std::endl;
-            std::string odometry = "odometry_" + std::to_string(i);
-
-            // Read quaternions
-            std::cout << "Reading quaternions file..."<< std::flush;
-            quart_vector_t quaternions_time;
-            read_quaternions_file( quaternions_time,
-                                   data_dir + "/odometry/" + odometry + "/quaternions" );
-            std::cout << "Done." << std::endl;
-
-            // Interpolate quaternions
-            std::cout << "Interpolating quaternions..."<< std::flush;
-            vector4d_t interpolated_quaternions;
-            interpolate_quaternions( interpolated_quaternions, quaternions_time );
-            std::cout << "Done." << std::endl;
-
-            // Load datapackets
-            std::cout << "Loading datapackets..."<< std::endl;
-            std::vector<std::vector<point_cloud_w_labels> >
-                datapacket_clouds = load_datapackets(data_dir + "/odometry/" + odometry + "/datapackets");
-            std::cout << "Done." << std::endl;
-
-            // Combine datapackets to scans
-            std::cout << "Combining datapackets to scans..."<< std::flush;
-            combine_datapackets_to_scans(datapacket_clouds,
-                                         interpolated_quaternions,
-                                         data_dir + "/odometry/" + odometry);
-            std::cout << "Done." << std::endl;
-
-            // Estimate translation
-            std::cout << "Estimating translation..."<< std::flush;
-            Eigen::Vector3f translation{0, 0, 0};
-            translation_estimation(data_dir + "/odometry/" + odometry + "/scans", translation);
-            translations.push_back(translation);
-            std::cout << "Done." << std::endl;
+    // Visualize fragments
+    if (visualization) {
+        for (int i = 0; i < fragments; ++i) {
+            visualize_fragment(data_dir + "/fragments/fragment_" + std::to_string(i));
         }
-        std::cout << std::endl << std::endl;
+    }
 
-        /////////////////////////// Fragment pairwise registration with odometry ////////////////////////////////////////////////////////
+    /////////////////////////// Fragment pairwise registration with odometry ////////////////////////////////////////////////////////
+    if (registration_in_graph) {
+        if (pairwise) {
+            // Chain the pairwise results into poses, loading the fragments one at a time
+            registration.add_registered(fragment_source.load(0), Eigen::Matrix4f::Identity(), PoseGraph::information_t::Zero());
+            for (int i = 1; i < registered_fragments; ++i) {
+                registration.add_registered(fragment_source.load(i), pair_steps[i], pair_informations[i]);
+            }
+        }
+        if (cmdline.getLoopClosures() > 0) {
+            registration.close_loops(fragment_source, cmdline.getLoopClosures());
+        }
+        registration.finish(fragment_source, data_dir);
+    } else if (odometry) {
         std::cout << "Fragment pairwise registration" << std::endl << std::endl;
-        std::vector<point_cloud> fragment_clouds = load_fragments(data_dir + "/fragments", fragments);
-        incremental_pairwise_registration(fragment_clouds,
+        incremental_pairwise_registration(fragment_source,
                                           translations,
                                           data_dir,
                                           cmdline.getICPType(),
-                                          visualization);
+                                          visualization,
+                                          cmdline.getSubmapFragments(),
+                                          cmdline.getSubmapRadius(),
+                                          cmdline.getMapResolution(),
+                                          cmdline.getLoopClosures(),
+                                          pyramid,
+                                          cmdline.getCoarseAlignment());
     }
     //////////////////////////////////////////// END ////////////////////////////////////////////////////////////////////////
     return 0;
@@ -1,11 +1,18 @@
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
 #include <pcl/point_cloud.h>
 #include <pcl/search/kdtree.h>
-#include <pcl/features/normal_3d_omp.h>
+#include <pcl/common/io.h>
+#include <pcl/common/transforms.h>
 #include <pcl/registration/icp_nl.h>
 #include <pcl/registration/gicp.h>
 #include <pcl/filters/normal_space.h>
 #include <pcl/filters/covariance_sampling.h>
 #include <pcl/filters/extract_indices.h>
+#include <pcl/filters/voxel_grid.h>
 #include <pcl/visualization/pcl_visualizer.h>
 #include <pcl/pcl_config.h>
 
@@ -15,8 +22,17 @@
 #include <eigen3/Eigen/Dense>
 #endif
 
+#include "point_to_plane_icp.h"
+#include "vgicp.h"
 #include "registration.h"
 
+// Neighbours of the GICP covariances, the same as PCL's default
+constexpr int gicp_correspondence_randomness = 20;
+
+// Small-angle refinement after the gravity constrained alignment
+constexpr int gravity_refinement_iterations = 3;
+constexpr float gravity_refinement_distance = 0.1f;
+
 Registration::Registration(float sample_porportion,
                            double icp_transformation_epsilon,
                            float icp_euclidean_fitness_epsilon,
@@ -34,86 +50,245 @@ Registration::Registration(float sample_porportion,
       normals_nn_search_{normals_nn_search}
 {}
 
-///////////////////////////////////////////////// Normals estimation ////////////////////////////////////////////////////
-void
-Registration::normals_estimation(pcl::PointCloud<pcl::PointNormal>::Ptr cloud)
+///////////////////////////////////////////////// Pyramid ////////////////////////////////////////////////////
+std::vector<PyramidLevel>
+Registration::default_pyramid()
 {
-    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_xyz(new pcl::PointCloud<pcl::PointXYZ>);
-    pcl::PointCloud<pcl::Normal>::Ptr normals(new pcl::PointCloud<pcl::Normal>);
-    pcl::copyPointCloud(*cloud, *cloud_xyz);
-    pcl::NormalEstimationOMP<pcl::PointXYZ, pcl::Normal> ne;
-    pcl::search::KdTree<pcl::PointXYZ>::Ptr kd_tree(new pcl::search::KdTree<pcl::PointXYZ>());
-    ne.setSearchMethod(kd_tree);
-    ne.setInputCloud(cloud_xyz);
-    ne.setKSearch(normals_nn_search_);
-    ne.compute(*normals);
-    pcl::concatenateFields<pcl::PointNormal, pcl::Normal, pcl::PointNormal>(*cloud, *normals, *cloud);
+    std::vector<PyramidLevel> pyramid;
+    pyramid.push_back({0.2f, 1.0f, 10, 1e-6});
+    pyramid.push_back({0.1f, 0.5f, 5, 1e-7});
+    pyramid.push_back({0.05f, 0.25f, 5, 1e-8});
+    return pyramid;
 }
 
-////////////////////////////////////////////////// Alignment Non-linear ICP //////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Hands the prepared clouds and their search trees to a PCL registration
+template <typename ICP>
+static void
+set_inputs(ICP &icp, PreparedCloud &target, PreparedCloud &source)
+{
+    icp.setInputTarget(target.cloud());
+    icp.setSearchMethodTarget(target.search(), true);
+    icp.setInputSource(source.cloud());
+    icp.setSearchMethodSource(source.search(), true);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// As above with the cached covariances, GICP drops them when the inputs are set
+static void
+set_inputs(pcl::GeneralizedIterativeClosestPoint<pcl::PointNormal, pcl::PointNormal> &icp,
+           PreparedCloud &target,
+           PreparedCloud &source)
+{
+    icp.setInputTarget(target.cloud());
+    icp.setSearchMethodTarget(target.search(), true);
+    icp.setTargetCovariances(target.covariances(gicp_correspondence_randomness));
+    icp.setInputSource(source.cloud());
+    icp.setSearchMethodSource(source.search(), true);
+    icp.setSourceCovariances(source.covariances(gicp_correspondence_randomness));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static void
+set_inputs(PointToPlaneICP &icp, PreparedCloud &target, PreparedCloud &source)
+{
+    icp.setSearchMethodTarget(target.search(), target.cloud());
+    icp.setInputTarget(target.cloud());
+    icp.setInputSource(source.cloud());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// VGICP aggregates voxels instead of searching, those of the target are cached
+static void
+set_inputs(VoxelizedGICP &icp, PreparedCloud &target, PreparedCloud &source)
+{
+    icp.setInputTarget(target.cloud(), target.voxels(static_cast<float>(icp.getMaxCorrespondenceDistance())));
+    icp.setInputSource(source.cloud());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename ICP>
 void
-Registration::alignment_icp_nl(pcl::PointCloud<pcl::PointNormal>::Ptr target,
-                               pcl::PointCloud<pcl::PointNormal>::Ptr source,
-                               Eigen::Matrix4f &transformation)
+Registration::align(ICP &icp, PreparedCloud &target, PreparedCloud &source, Eigen::Matrix4f &transformation)
 {
     pcl::PointCloud<pcl::PointNormal>::Ptr icp_result(new pcl::PointCloud<pcl::PointNormal>);
-    pcl::IterativeClosestPointNonLinear<pcl::PointNormal, pcl::PointNormal> icp;
-    icp.setTransformationEpsilon(icp_transformation_epsilon_);
-    icp.setMaxCorrespondenceDistance(icp_max_correspondence_distance_);
     icp.setEuclideanFitnessEpsilon(icp_euclidean_fitness_epsilon_);
-    icp.setMaximumIterations(icp_maximum_iterations_);
     icp.setRANSACOutlierRejectionThreshold(icp_ransac_outlier_rejection_threshold_);
-    icp.setInputTarget(target);
-    icp.setInputSource(source);
-    icp.align(*icp_result);
+    if (pyramid_.empty()) {
+        icp.setTransformationEpsilon(icp_transformation_epsilon_);
+        icp.setMaxCorrespondenceDistance(icp_max_correspondence_distance_);
+        icp.setMaximumIterations(icp_maximum_iterations_);
+        set_inputs(icp, target, source);
+        icp.align(*icp_result);
+
+        // Source to target transformation matrix
+        transformation = icp.getFinalTransformation();
+        return;
+    }
+
+    // Every level starts from the result of the coarser one
+    Eigen::Matrix4f guess = Eigen::Matrix4f::Identity();
+    for (std::size_t l = 0; l < pyramid_.size(); ++l) {
+        const PyramidLevel &level = pyramid_[l];
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        PreparedCloud &target_level = target.level(level.voxel_size);
+        PreparedCloud &source_level = source.level(level.voxel_size);
+        icp.setTransformationEpsilon(level.transformation_epsilon);
+        icp.setMaxCorrespondenceDistance(level.max_correspondence_distance);
+        icp.setMaximumIterations(level.maximum_iterations);
+        set_inputs(icp, target_level, source_level);
+        icp.align(*icp_result, guess);
+        guess = icp.getFinalTransformation();
+        const double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        // One write per line, levels of concurrent alignments may be reported at the same time
+        std::ostringstream report;
+        report << "ICP level " << l << " (" << level.voxel_size << " m, "
+               << target_level.size() << " / " << source_level.size() << " points): fitness "
+               << icp.getFitnessScore(level.max_correspondence_distance) << ", " << milliseconds << " ms" << std::endl;
+        std::cout << report.str() << std::flush;
+    }
 
     // Source to target transformation matrix
-    transformation = icp.getFinalTransformation();
+    transformation = guess;
+}
+
+///////////////////////////////////////////////// Normals estimation ////////////////////////////////////////////////////
+void
+Registration::normals_estimation(PreparedCloud &cloud)
+{
+    cloud.estimate_normals(normals_nn_search_);
+}
+
+////////////////////////////////////////////////// Alignment Non-linear ICP //////////////////////////////////////////////////////
+void
+Registration::alignment_icp_nl(PreparedCloud &target,
+                               PreparedCloud &source,
+                               Eigen::Matrix4f &transformation)
+{
+    pcl::IterativeClosestPointNonLinear<pcl::PointNormal, pcl::PointNormal> icp;
+    align(icp, target, source, transformation);
 }
 
 #if PCL_VERSION_COMPARE(>, 1, 10, 0)
 //////////////////////////// Alignment ICP with normals and symmetric objective ////////////////////////////////////////
 void
-Registration::alignment_icp_symmetric(pcl::PointCloud<pcl::PointNormal>::Ptr target,
-                               pcl::PointCloud<pcl::PointNormal>::Ptr source,
+Registration::alignment_icp_symmetric(PreparedCloud &target,
+                               PreparedCloud &source,
                                Eigen::Matrix4f &transformation)
 {
-    pcl::PointCloud<pcl::PointNormal>::Ptr icp_result(new pcl::PointCloud<pcl::PointNormal>);
     pcl::IterativeClosestPointWithNormals<pcl::PointNormal, pcl::PointNormal> icp;
-    icp.setTransformationEpsilon(icp_transformation_epsilon_);
     icp.setUseSymmetricObjective(true);
-    icp.setMaxCorrespondenceDistance(icp_max_correspondence_distance_);
-    icp.setEuclideanFitnessEpsilon(icp_euclidean_fitness_epsilon_);
-    icp.setMaximumIterations(icp_maximum_iterations_);
-    icp.setRANSACOutlierRejectionThreshold(icp_ransac_outlier_rejection_threshold_);
-    icp.setInputTarget(target);
-    icp.setInputSource(source);
-    icp.align(*icp_result);
-
-    // Source to target transformation matrix
-    transformation = icp.getFinalTransformation();
+    align(icp, target, source, transformation);
 }
 #endif
 
 //////////////////////////////////////////// Alignment Generalized ICP ///////////////////////////////////////////////
 void
-Registration::alignment_gicp(pcl::PointCloud<pcl::PointNormal>::Ptr target,
-                             pcl::PointCloud<pcl::PointNormal>::Ptr source,
+Registration::alignment_gicp(PreparedCloud &target,
+                             PreparedCloud &source,
                              Eigen::Matrix4f &transformation)
 {
-    pcl::PointCloud<pcl::PointNormal>::Ptr icp_result(new pcl::PointCloud<pcl::PointNormal>);
     pcl::GeneralizedIterativeClosestPoint<pcl::PointNormal, pcl::PointNormal> icp;
-    icp.setTransformationEpsilon(icp_transformation_epsilon_);
-    icp.setMaxCorrespondenceDistance(icp_max_correspondence_distance_);
-    icp.setEuclideanFitnessEpsilon(icp_euclidean_fitness_epsilon_);
-    icp.setMaximumIterations(icp_maximum_iterations_);
-    icp.setRANSACOutlierRejectionThreshold(icp_ransac_outlier_rejection_threshold_);
-    icp.setInputTarget(target);
-    icp.setInputSource(source);
-    icp.align(*icp_result);
+    icp.setCorrespondenceRandomness(gicp_correspondence_randomness);
+    align(icp, target, source, transformation);
+}
 
-    // Source to target transformation matrix
-    transformation = icp.getFinalTransformation();
+//////////////////////////////////////////// Alignment native point-to-plane ICP ///////////////////////////////////////////////
+void
+Registration::alignment_icp_point_to_plane(PreparedCloud &target,
+                                           PreparedCloud &source,
+                                           Eigen::Matrix4f &transformation,
+                                           const bool symmetric)
+{
+    PointToPlaneICP icp;
+    icp.setUseSymmetricObjective(symmetric);
+    align(icp, target, source, transformation);
+}
+
+//////////////////////////////////////////// Alignment gravity constrained ICP ///////////////////////////////////////////////
+void
+Registration::alignment_gravity(PreparedCloud &target,
+                                PreparedCloud &source,
+                                Eigen::Matrix4f &transformation,
+                                const bool refine)
+{
+    PointToPlaneICP icp;
+    icp.setGravityConstrained(true);
+    align(icp, target, source, transformation);
+    if (!refine) {
+        return;
+    }
+
+    PointToPlaneICP refinement;
+    refinement.setTransformationEpsilon(icp_transformation_epsilon_);
+    refinement.setRANSACOutlierRejectionThreshold(icp_ransac_outlier_rejection_threshold_);
+    refinement.setMaxCorrespondenceDistance(gravity_refinement_distance);
+    refinement.setMaximumIterations(gravity_refinement_iterations);
+    set_inputs(refinement, target, source);
+    pcl::PointCloud<pcl::PointNormal> result;
+    refinement.align(result, transformation);
+    transformation = refinement.getFinalTransformation();
+}
+
+//////////////////////////////////////////// Alignment voxelized GICP ///////////////////////////////////////////////
+void
+Registration::alignment_vgicp(PreparedCloud &target,
+                              PreparedCloud &source,
+                              Eigen::Matrix4f &transformation)
+{
+    VoxelizedGICP icp;
+    align(icp, target, source, transformation);
+}
+
+//////////////////////////////////////////// Information matrix ///////////////////////////////////////////////
+std::size_t
+Registration::information_matrix(PreparedCloud &target,
+                                 PreparedCloud &source,
+                                 const Eigen::Matrix4f &transformation,
+                                 Eigen::Matrix<double, 6, 6> &information)
+{
+    pcl::PointCloud<pcl::PointNormal>::Ptr source_transformed(new pcl::PointCloud<pcl::PointNormal>);
+    pcl::transformPointCloud(*source.cloud(), *source_transformed, transformation);
+    const PreparedCloud::search_t::Ptr kd_tree = target.search();
+
+    // A small motion (translation t, rotation r) moves a target point p by t - [p]x r
+    information.setZero();
+    const float max_distance_squared = icp_max_correspondence_distance_ * icp_max_correspondence_distance_;
+    std::size_t correspondences = 0;
+    std::vector<int> index(1);
+    std::vector<float> distance_squared(1);
+    for (std::size_t i = 0; i < source_transformed->size(); ++i) {
+        if (kd_tree->nearestKSearch(source_transformed->points[i], 1, index, distance_squared) == 0
+            || distance_squared[0] > max_distance_squared) {
+            continue;
+        }
+        const Eigen::Vector3d p = target.cloud()->points[index[0]].getVector3fMap().cast<double>();
+        Eigen::Matrix<double, 3, 6> G;
+        G << 1, 0, 0,     0,  p.z(), -p.y(),
+             0, 1, 0, -p.z(),     0,  p.x(),
+             0, 0, 1,  p.y(), -p.x(),     0;
+        information += G.transpose() * G;
+        ++correspondences;
+    }
+    return correspondences;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+std::size_t
+Registration::information_matrix_vgicp(PreparedCloud &target,
+                                       PreparedCloud &source,
+                                       const Eigen::Matrix4f &transformation,
+                                       Eigen::Matrix<double, 6, 6> &information)
+{
+    // The voxels of the finest alignment, the target's are still cached
+    const float distance = pyramid_.empty() ? icp_max_correspondence_distance_ : pyramid_.back().max_correspondence_distance;
+    PreparedCloud &target_level = target.level(pyramid_.empty() ? 0 : pyramid_.back().voxel_size);
+    PreparedCloud &source_level = source.level(pyramid_.empty() ? 0 : pyramid_.back().voxel_size);
+    VoxelizedGICP icp;
+    icp.setMaxCorrespondenceDistance(distance);
+    set_inputs(icp, target_level, source_level);
+    return icp.getInformationMatrix(transformation, information);
 }
 
 ////////////////////////////////////////// Visualization ////////////////////////////////////////////////////
@@ -182,4 +357,16 @@ Registration::covariance_sampling(pcl::PointCloud<pcl::PointNormal>::Ptr input_c
     extraction.setNegative(false);
     extraction.filter(*output_cloud);
 }
+
+/////////////////////////////////////////// Voxel sampling ///////////////////////////////////////////////////////////////////////////////////////
+void
+Registration::voxel_sampling(pcl::PointCloud<pcl::PointNormal>::Ptr input_cloud,
+                             pcl::PointCloud<pcl::PointNormal>::Ptr output_cloud,
+                             float voxel_size)
+{
+    pcl::VoxelGrid<pcl::PointNormal> voxel_grid;
+    voxel_grid.setInputCloud(input_cloud);
+    voxel_grid.setLeafSize(voxel_size, voxel_size, voxel_size);
+    voxel_grid.filter(*output_cloud);
+}
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
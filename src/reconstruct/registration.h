@@ -1,6 +1,10 @@
 #pragma once
 
+#include <cstddef>
+#include <vector>
+
 #include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
 #include <pcl/pcl_config.h>
 
 #if defined __GNUC__ || defined __APPLE__
@@ -9,6 +13,18 @@
 #include <eigen3/Eigen/Dense>
 #endif
 
+#include "prepared_cloud.h"
+
+// One level of the coarse-to-fine alignment: both clouds are downsampled to voxel_size (0 keeps
+// them as they are) and aligned with the level's own ICP settings, seeded by the previous level
+struct PyramidLevel
+{
+    float voxel_size;
+    float max_correspondence_distance;
+    int maximum_iterations;
+    double transformation_epsilon;
+};
+
 class Registration
 {
 private:
@@ -22,6 +38,13 @@ private:
 
     // Normals estimation parameter
     int normals_nn_search_;
+
+    // Coarse-to-fine levels, empty for a single alignment with the parameters above
+    std::vector<PyramidLevel> pyramid_;
+
+    template <typename ICP>
+    void
+    align(ICP &icp, PreparedCloud &target, PreparedCloud &source, Eigen::Matrix4f &transformation);
 public:
     Registration(float sample_porportion,
                  double icp_transformation_epsilon,
@@ -30,8 +53,18 @@ public:
                  float icp_ransac_outlier_rejection_threshold,
                  float icp_max_correspondence_distance,
                  int normals_nn_search);
+    // 20, 10 and 5 cm levels with shrinking correspondence distances
+    static std::vector<PyramidLevel>
+    default_pyramid();
+
+    // Makes the alignment_* methods align coarse to fine. Timing and fitness of every level are
+    // reported.
+    void
+    set_pyramid(const std::vector<PyramidLevel> &pyramid) { pyramid_ = pyramid; }
+
+    // Normals from the cached search tree of the cloud
     void
-    normals_estimation(pcl::PointCloud<pcl::PointNormal>::Ptr cloud);
+    normals_estimation(PreparedCloud &cloud);
 
     void
     normal_space_sampling(pcl::PointCloud<pcl::PointNormal>::Ptr input_cloud,
@@ -41,23 +74,71 @@ public:
     covariance_sampling(pcl::PointCloud<pcl::PointNormal>::Ptr input_cloud,
                         pcl::PointCloud<pcl::PointNormal>::Ptr output_cloud);
 
+    // One point per voxel at the centroid of its points, needs no normals
     void
-    alignment_icp_nl(const pcl::PointCloud<pcl::PointNormal>::Ptr target,
-                     const pcl::PointCloud<pcl::PointNormal>::Ptr source,
+    voxel_sampling(pcl::PointCloud<pcl::PointNormal>::Ptr input_cloud,
+                   pcl::PointCloud<pcl::PointNormal>::Ptr output_cloud,
+                   float voxel_size);
+
+    // The alignments take prepared clouds and reuse their search trees and covariances, so a cloud
+    // that is aligned several times is preprocessed once
+    void
+    alignment_icp_nl(PreparedCloud &target,
+                     PreparedCloud &source,
                      Eigen::Matrix4f &transformation);
 
     #if PCL_VERSION_COMPARE(>, 1, 10, 0)
     void
-    alignment_icp_symmetric(const pcl::PointCloud<pcl::PointNormal>::Ptr target,
-                     const pcl::PointCloud<pcl::PointNormal>::Ptr source,
+    alignment_icp_symmetric(PreparedCloud &target,
+                     PreparedCloud &source,
                      Eigen::Matrix4f &transformation);
     #endif
 
+    // In-house point-to-plane ICP, multi-threaded, optionally with the symmetric objective. Works
+    // with every PCL version.
+    void
+    alignment_icp_point_to_plane(PreparedCloud &target,
+                                 PreparedCloud &source,
+                                 Eigen::Matrix4f &transformation,
+                                 const bool symmetric = false);
+
+    // Point-to-plane ICP of yaw and translation for clouds leveled with gravity along z. With
+    // refine a few unconstrained iterations with a short correspondence distance follow, which
+    // correct the small roll and pitch errors of the leveling.
+    void
+    alignment_gravity(PreparedCloud &target,
+                      PreparedCloud &source,
+                      Eigen::Matrix4f &transformation,
+                      const bool refine = false);
+
+    // Voxelized GICP: no kd-tree, the maximum correspondence distance is the voxel size
+    void
+    alignment_vgicp(PreparedCloud &target,
+                    PreparedCloud &source,
+                    Eigen::Matrix4f &transformation);
+
     void
-    alignment_gicp(const pcl::PointCloud<pcl::PointNormal>::Ptr target,
-                   const pcl::PointCloud<pcl::PointNormal>::Ptr source,
+    alignment_gicp(PreparedCloud &target,
+                   PreparedCloud &source,
                    Eigen::Matrix4f &transformation);
 
+    // Information matrix of an alignment, ordered (translation, rotation), from the correspondences
+    // of the transformed source points within the maximum correspondence distance of the target.
+    // Returns the number of correspondences.
+    std::size_t
+    information_matrix(PreparedCloud &target,
+                       PreparedCloud &source,
+                       const Eigen::Matrix4f &transformation,
+                       Eigen::Matrix<double, 6, 6> &information);
+
+    // As above for alignment_vgicp: the voxel correspondences of its finest level weighted by the
+    // voxel covariances, without a search tree
+    std::size_t
+    information_matrix_vgicp(PreparedCloud &target,
+                             PreparedCloud &source,
+                             const Eigen::Matrix4f &transformation,
+                             Eigen::Matrix<double, 6, 6> &information);
+
     void
     visualize(pcl::PointCloud<pcl::PointNormal>::Ptr cloud_1, pcl::PointCloud<pcl::PointNormal>::Ptr cloud_2);
 };
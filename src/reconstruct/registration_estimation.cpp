@@ -1,11 +1,16 @@
 #include <algorithm>
+#include <chrono>
 #include <fstream>
+#include <future>
+#include <memory>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <vector>
 
 #include <pcl/point_cloud.h>
 #include <pcl/io/pcd_io.h>
+#include <pcl/common/transforms.h>
 #include <pcl/registration/transforms.h>
 
 #if defined __GNUC__ || defined __APPLE__
@@ -16,128 +21,740 @@
 
 #include <boost/filesystem.hpp>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "coarse_alignment.h"
+#include "fragment_source.h"
 #include "load_data.h"
+#include "loam_features.h"
 #include "registration.h"
+#include "place_recognition.h"
+#include "projective_icp.h"
+#include "registration_estimation.h"
+#include "thread_pool.h"
+#include "voxel_map.h"
 
 using namespace boost::filesystem;
 
+// Voxel size of the registration map when the map resolution is not set
+constexpr float submap_resolution = 0.05f;
+
+// Spacing of the returns along a ring in the sample of an odometry scan. Close to the sensor the
+// returns are millimetres apart and would dominate the alignment.
+constexpr float scan_voxel_size = 0.05f;
+
+// Voxel size of the fragment sample of VGICP, which needs neither normals nor a covariance sample
+constexpr float vgicp_sample_resolution = 0.05f;
+
+// Minimum fraction of the sampled points of a loop closure candidate with a correspondence after
+// the alignment
+constexpr double loop_closure_min_overlap = 0.3;
+
+// Standard deviation of the sensor velocity at the start of a scan pair estimated from the previous
+// pair, in m/s
+constexpr double odometry_velocity_sigma = 0.2;
+
+typedef std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f> > transformations_t;
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
-void
-translation_estimation(const std::string data_path, Eigen::Vector3f &translation)
+// Normals, normal space sample and its search tree of a scan. Every scan is the target of one pair
+// and the source of the next, so the features are computed once when the scan arrives and kept for
+// the second pair. The normals come from the range image if the scan has one, which also thins the
+// returns along the rings, otherwise from the nearest neighbours.
+static std::shared_ptr<PreparedCloud>
+scan_features(Registration &reg, const Scan &scan)
 {
-    Registration reg(0.25, 1e-8, 0.01, 5, 0.1, 0.5, 10);
+    PreparedCloud cloud(pcl::PointCloud<pcl::PointNormal>::Ptr(new pcl::PointCloud<pcl::PointNormal>));
+    pcl::PointCloud<pcl::PointNormal>::Ptr sampled(new pcl::PointCloud<pcl::PointNormal>);
+    if (scan.image) {
+        scan.image->normals(*cloud.cloud(), scan_voxel_size);
+    } else {
+        pcl::copyPointCloud(*scan.cloud, *cloud.cloud());
+        reg.normals_estimation(cloud);
+    }
+    reg.normal_space_sampling(cloud.cloud(), sampled);
 
-    // Data variables
-    pcl::PointCloud<pcl::PointNormal>::Ptr target(new pcl::PointCloud<pcl::PointNormal>);
-    pcl::PointCloud<pcl::PointNormal>::Ptr source(new pcl::PointCloud<pcl::PointNormal>);
-    pcl::PointCloud<pcl::PointNormal>::Ptr target_sampled(new pcl::PointCloud<pcl::PointNormal>);
-    pcl::PointCloud<pcl::PointNormal>::Ptr source_sampled(new pcl::PointCloud<pcl::PointNormal>);
+    // The search tree is built here, the two pairs of the scan only read it concurrently
+    const std::shared_ptr<PreparedCloud> prepared = std::make_shared<PreparedCloud>(sampled);
+    prepared->search();
+    return prepared;
+}
 
-    /////////////////////////////// Non-incremental pairwise registration for translation estimation /////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Aligns every scan of the stream with the previous one, starting with `scan`. The pairs only depend
+// on their two scans. The features are prepared here as the scans arrive, the alignments run on the
+// pool.
+static void
+icp_odometry(ScanStream &scans, Scan scan, const unsigned threads, transformations_t &steps)
+{
+    Registration reg(0.25, 1e-8, 0.01, 5, 0.1, 0.5, 10);
 
     // The first point cloud is the source
-    pcl::io::loadPCDFile<pcl::PointNormal>(data_path + "/scan_0.pcd", *source);
+    std::shared_ptr<PreparedCloud> source_sampled = scan_features(reg, scan);
+    scan = Scan();
 
-    // Align all other point clouds pairwise
-    int scans = number_of_scans(data_path);
-    for (int i = 1; i < scans; ++i) {
-        std::string scan = "/scan_" + std::to_string(i);
+    std::vector<std::future<Eigen::Matrix4f> > pairs;
+    {
+        ThreadPool pool(threads);
+        while (scans.pop(scan)) {
+            const std::shared_ptr<PreparedCloud> target_sampled = scan_features(reg, scan);
+            scan = Scan();
 
-        // Import new target cloud
-        pcl::io::loadPCDFile<pcl::PointNormal>(data_path + scan + ".pcd", *target);
+            pairs.push_back(pool.submit([reg, target_sampled, source_sampled]() mutable {
+#ifdef _OPENMP
+                // The pairs already use all threads
+                omp_set_num_threads(1);
+#endif
+                Eigen::Matrix4f transformation_matrix = Eigen::Matrix4f::Identity();
+                reg.alignment_icp_nl(*target_sampled, *source_sampled, transformation_matrix);
+                return transformation_matrix;
+            }));
 
-        // Prepare target cloud for alignment
-        reg.normals_estimation(target);
-        reg.normal_space_sampling(target, target_sampled);
+            // Target is the source in the next alignment, its features are reused
+            source_sampled = target_sampled;
+        }
+    }
+    for (std::size_t i = 0; i < pairs.size(); ++i) {
+        steps.push_back(pairs[i].get());
+    }
+}
 
-        // Prepare source cloud for alignment
-        reg.normals_estimation(source);
-        reg.normal_space_sampling(source, source_sampled);
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Guess of a scan pair: the IMU motion over the pair starting with `velocity`, which also becomes the
+// prior of the alignment, or without IMU motion the result of the previous pair
+template <typename ICP>
+static Eigen::Matrix4f
+motion_guess(ICP &icp,
+             const ImuPreintegration::ConstPtr &motion,
+             const Eigen::Vector3d &velocity,
+             const Eigen::Matrix4f &previous)
+{
+    if (!motion) {
+        icp.clearPrior();
+        return previous;
+    }
+    Eigen::Matrix4f prior;
+    Eigen::Matrix<double, 6, 6> information;
+    motion->prior(velocity, odometry_velocity_sigma, prior, information);
+    icp.setPrior(prior, information);
+    return prior;
+}
 
-        // Align source and target
-        Eigen::Matrix4f transformation_matrix = Eigen::Matrix4f::Identity();
-        reg.alignment_icp_nl(target_sampled, source_sampled, transformation_matrix);
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sensor velocity at the end of a scan pair aligned with `transformation`: the mean velocity over the
+// pair plus half of the change measured by the IMU
+static Eigen::Vector3d
+end_velocity(const ImuPreintegration::ConstPtr &motion, const Eigen::Matrix4f &transformation)
+{
+    if (!motion || motion->duration() <= 0) {
+        return Eigen::Vector3d::Zero();
+    }
+    return -transformation.col(3).head<3>().cast<double>() / motion->duration() + 0.5 * motion->delta_velocity();
+}
 
-        // Store translation
-        translation += transformation_matrix.col(3).head<3>();
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// As above with projective data association on the range images. An alignment takes a few
+// milliseconds, so the pairs run one after the other and each starts from the IMU motion or the
+// motion of the previous one. Scans without a range image are skipped, the IMU motion of the pair
+// after a skipped scan is incomplete and not used.
+static void
+projective_odometry(ScanStream &scans, const Scan &first, transformations_t &steps)
+{
+    ProjectiveICP icp;
+    icp.setMaxCorrespondenceDistance(0.5);
+    icp.setMaximumIterations(10);
+    icp.setTransformationEpsilon(1e-8);
 
-        // Target is the source in the next alignment
-        source->swap(*target);
+    RangeImage::ConstPtr source = first.image;
+    Eigen::Matrix4f result = Eigen::Matrix4f::Identity();
+    Eigen::Vector3d velocity = Eigen::Vector3d::Zero();
+    bool skipped = false;
+    Scan scan;
+    while (scans.pop(scan)) {
+        if (!scan.image) {
+            skipped = true;
+            continue;
+        }
+        const ImuPreintegration::ConstPtr motion = skipped ? ImuPreintegration::ConstPtr() : scan.motion;
+        skipped = false;
+        icp.setInputTarget(scan.image);
+        icp.setInputSource(source);
+        icp.align(motion_guess(icp, motion, velocity, result));
+        result = icp.getFinalTransformation();
+        velocity = end_velocity(motion, result);
+        steps.push_back(result);
+        source = scan.image;
     }
 }
 
-////////////////////////////// Incremental pairwise registration ///////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// As above on the edge and planar features of the range images. Only the time of the stages and the
+// number of features are reported.
+static void
+feature_odometry(ScanStream &scans, const Scan &first, transformations_t &steps)
+{
+    FeatureICP icp;
+    icp.setMaxCorrespondenceDistance(0.5);
+    icp.setMaximumIterations(10);
+    icp.setTransformationEpsilon(1e-8);
 
+    FeatureTiming timing;
+    const auto milliseconds_since = [](const std::chrono::steady_clock::time_point &start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+    const auto features = [&](const RangeImage &image) {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        ScanFeatures::Ptr features(new ScanFeatures);
+        extract_features(image, *features);
+        timing.extraction += milliseconds_since(start);
+        ++timing.scans;
+        timing.edges += features->edges->size();
+        timing.planes += features->planes->size();
+        return features;
+    };
+
+    ScanFeatures::Ptr source = features(*first.image);
+    Eigen::Matrix4f result = Eigen::Matrix4f::Identity();
+    Eigen::Vector3d velocity = Eigen::Vector3d::Zero();
+    bool skipped = false;
+    Scan scan;
+    while (scans.pop(scan)) {
+        if (!scan.image) {
+            skipped = true;
+            continue;
+        }
+        const ImuPreintegration::ConstPtr motion = skipped ? ImuPreintegration::ConstPtr() : scan.motion;
+        skipped = false;
+        const ScanFeatures::Ptr target = features(*scan.image);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        icp.setInputTarget(target);
+        timing.indexing += milliseconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        icp.setInputSource(source);
+        icp.align(motion_guess(icp, motion, velocity, result));
+        result = icp.getFinalTransformation();
+        velocity = end_velocity(motion, result);
+        timing.alignment += milliseconds_since(start);
+
+        steps.push_back(result);
+        source = target;
+    }
+
+    // One write, odometry runs may finish at the same time
+    std::ostringstream report;
+    report << "Feature odometry: " << timing.scans << " scans, " << timing.edges / std::max<std::size_t>(timing.scans, 1)
+           << " edges and " << timing.planes / std::max<std::size_t>(timing.scans, 1) << " planar points per scan, "
+           << "extraction " << timing.extraction << " ms, indexing " << timing.indexing << " ms, alignment "
+           << timing.alignment << " ms" << std::endl;
+    std::cout << report.str() << std::flush;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void
-incremental_pairwise_registration(const std::vector<pcl::PointCloud<pcl::PointXYZ> > &clouds,
-                                  const std::vector<Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f> > &translations,
-                                  const std::string &data_dir,
-                                  const std::string &icp_type,
-                                  const bool visualization)
+translation_estimation(ScanStream &scans,
+                       Eigen::Vector3f &translation,
+                       const bool compose,
+                       const unsigned threads,
+                       const OdometryMethod method)
 {
-    Registration reg(0.25, 1e-8, 0.01, 5, 0.1, 1, 10);
+    /////////////////////////////// Non-incremental pairwise registration for translation estimation /////////////////////////////////////////////
 
-    // Data variables
-    pcl::PointCloud<pcl::PointNormal>::Ptr target(new pcl::PointCloud<pcl::PointNormal>);
-    pcl::PointCloud<pcl::PointNormal>::Ptr source(new pcl::PointCloud<pcl::PointNormal>);
-    pcl::PointCloud<pcl::PointNormal>::Ptr target_sampled(new pcl::PointCloud<pcl::PointNormal>);
-    pcl::PointCloud<pcl::PointNormal>::Ptr source_sampled(new pcl::PointCloud<pcl::PointNormal>);
+    Scan scan;
+    if (!scans.pop(scan)) {
+        return;
+    }
 
-    // The first point cloud is the source
-    pcl::copyPointCloud(clouds[0], *source);
+    // Captures without laser rings have no range images and are aligned with ICP
+    transformations_t steps;
+    if (method == PROJECTIVE_ODOMETRY && scan.image) {
+        projective_odometry(scans, scan, steps);
+    } else if (method == FEATURE_ODOMETRY && scan.image) {
+        feature_odometry(scans, scan, steps);
+    } else {
+        icp_odometry(scans, scan, threads, steps);
+    }
 
-    // Align all other point clouds pairwise
-    for (std::size_t i = 1; i < clouds.size(); ++i) {
-        // Initial alignment
-        Eigen::Matrix4f transformation_matrix = Eigen::Matrix4f::Identity();
-        transformation_matrix.col(3).head<3>() = translations[i - 1];
-        pcl::transformPointCloud(*source, *source, transformation_matrix);
+    // Reduce in scan order
+    Eigen::Matrix4f chain = Eigen::Matrix4f::Identity();
+    for (std::size_t i = 0; i < steps.size(); ++i) {
+        if (compose) {
+            chain = steps[i] * chain;
+        } else {
+            translation += steps[i].col(3).head<3>();
+        }
+    }
+    if (compose) {
+        translation += chain.col(3).head<3>();
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Settings of the fragment registration, shared by the incremental and the pairwise registration
+static Registration
+fragment_registration()
+{
+    return Registration(0.25, 1e-8, 0.01, 5, 0.1, 1, 10);
+}
+
+////////////////////////////// Incremental pairwise registration ///////////////////////////////////////////////////////////////////////////
+
+IncrementalRegistration::IncrementalRegistration(const std::string &icp_type,
+                                                 const bool visualization,
+                                                 const unsigned submap_fragments,
+                                                 const float submap_radius,
+                                                 const float map_resolution)
+    : reg_(fragment_registration()),
+      icp_type_{icp_type},
+      visualization_{visualization},
+      submap_fragments_{submap_fragments},
+      submap_radius_{submap_radius},
+      map_resolution_{map_resolution},
+      coarse_alignment_{false},
+      map_(map_resolution > 0 ? map_resolution : submap_resolution),
+      loop_closures_{0},
+      target_(new pcl::PointCloud<pcl::PointNormal>),
+      source_(new pcl::PointCloud<pcl::PointNormal>),
+      target_sampled_(pcl::PointCloud<pcl::PointNormal>::Ptr(new pcl::PointCloud<pcl::PointNormal>)),
+      source_sampled_(pcl::PointCloud<pcl::PointNormal>::Ptr(new pcl::PointCloud<pcl::PointNormal>))
+{}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+IncrementalRegistration::submap(const Eigen::Matrix4f &transformation, pcl::PointCloud<pcl::PointNormal> &cloud) const
+{
+    // The new fragment is expected at the origin
+    pcl::PointCloud<pcl::PointXYZ> window;
+    if (submap_fragments_ == 0 || submap_fragments_ >= poses_.size()) {
+        const Eigen::Matrix4f newest = graph_.pose(poses_.size() - 1).inverse().cast<float>();
+        map_.export_region(window, transformation * newest, submap_radius_);
+        pcl::copyPointCloud(window, cloud);
+        return;
+    }
+
+    const float radius_squared = submap_radius_ * submap_radius_;
+    const std::size_t first = poses_.size() - recent_fragments_.size();
+    for (std::size_t r = 0; r < recent_fragments_.size(); ++r) {
+        const pcl::PointCloud<pcl::PointXYZ> &fragment = *recent_fragments_[r];
+        const Eigen::Matrix4f pose = transformation * poses_[first + r];
+        const Eigen::Matrix3f rotation = pose.topLeftCorner<3, 3>();
+        const Eigen::Vector3f translation = pose.col(3).head<3>();
+        for (std::size_t k = 0; k < fragment.size(); ++k) {
+            const Eigen::Vector3f point = rotation * fragment.points[k].getVector3fMap() + translation;
+            if (submap_radius_ > 0 && point.squaredNorm() > radius_squared) {
+                continue;
+            }
+            window.push_back(pcl::PointXYZ(point.x(), point.y(), point.z()));
+        }
+    }
 
-        // Import new target cloud 
-        pcl::copyPointCloud(clouds[i], *target);
+    // Overlapping fragments are merged into one point per voxel
+    if (map_resolution_ > 0) {
+        VoxelMap map(map_resolution_);
+        map.insert(window);
+        map.export_cloud(window);
+    }
+    pcl::copyPointCloud(window, cloud);
+}
 
-        // Align source and target
-        std::cout << "Fragment " << i - 1 << " and " << i << " to be aligned." << std::endl;
-        if (visualization) {
-            reg.visualize(target, source);
-            std::cout << "Close the visualization to align." << std::endl;
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Aligns source with target using the requested ICP variant
+static void
+align_clouds(Registration &reg,
+             const std::string &icp_type,
+             PreparedCloud &target,
+             PreparedCloud &source,
+             Eigen::Matrix4f &transformation_matrix)
+{
+    if (icp_type == "non-linear") {
+        reg.alignment_icp_nl(target, source, transformation_matrix);
+    }
+    else if (icp_type == "point-to-plane") {
+        reg.alignment_icp_point_to_plane(target, source, transformation_matrix);
+    }
+    else if (icp_type == "point-to-plane-symmetric") {
+        reg.alignment_icp_point_to_plane(target, source, transformation_matrix, true);
+    }
+    else if (icp_type == "vgicp") {
+        reg.alignment_vgicp(target, source, transformation_matrix);
+    }
+    else if (icp_type == "gravity" || icp_type == "gravity-refined") {
+        reg.alignment_gravity(target, source, transformation_matrix, icp_type == "gravity-refined");
+    }
+    #if PCL_VERSION_COMPARE(>, 1, 10, 0)
+    else if (icp_type == "symmetric") {
+        reg.alignment_icp_symmetric(target, source, transformation_matrix);
+    }
+    #endif
+    else {
+        if (icp_type != "generalized") {
+            std::cerr << "Unrecognized ICP type " << icp_type
+                      << " requested. Using generalized ICP instead." << std::endl;
         }
+        reg.alignment_gicp(target, source, transformation_matrix);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Information matrix of an alignment by align_clouds. Returns the number of correspondences.
+static std::size_t
+alignment_information(Registration &reg,
+                      const std::string &icp_type,
+                      PreparedCloud &target,
+                      PreparedCloud &source,
+                      const Eigen::Matrix4f &transformation_matrix,
+                      PoseGraph::information_t &information)
+{
+    if (icp_type == "vgicp") {
+        return reg.information_matrix_vgicp(target, source, transformation_matrix, information);
+    }
+    return reg.information_matrix(target, source, transformation_matrix, information);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Fills sampled with the sample of cloud that align_clouds aligns: a voxel grid of the points for
+// VGICP, otherwise the covariance sample after estimating the normals of cloud
+static void
+sample_cloud(Registration &reg, const std::string &icp_type, PreparedCloud &cloud, PreparedCloud &sampled)
+{
+    if (icp_type == "vgicp") {
+        reg.voxel_sampling(cloud.cloud(), sampled.cloud(), vgicp_sample_resolution);
+    } else {
+        reg.normals_estimation(cloud);
+        reg.covariance_sampling(cloud.cloud(), sampled.cloud());
+    }
 
-        // Prepare target cloud for alignment
-        reg.normals_estimation(target);
-        reg.covariance_sampling(target, target_sampled);
+    // The sample was refilled in place
+    sampled.invalidate();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Features of the full cloud for the coarse alignment. The VGICP sample has no normals and the
+// covariance sample is too sparse, so the descriptors are computed on the normals of the cloud.
+static void
+describe_cloud(Registration &reg, PreparedCloud &cloud, CoarseAlignment::Features &features)
+{
+    reg.normals_estimation(cloud);
+    CoarseAlignment().describe(cloud, features);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Aligns the features of the full clouds and moves the sample of the source with the coarse
+// alignment if it is accepted. Otherwise the sample keeps the guess it came with and the final
+// transformation of coarse is the identity.
+static bool
+coarse_align(Registration &reg,
+             const std::string &icp_type,
+             PreparedCloud &target,
+             PreparedCloud &source,
+             PreparedCloud &source_sampled,
+             CoarseAlignment &coarse)
+{
+    CoarseAlignment::Features target_features;
+    CoarseAlignment::Features source_features;
+    describe_cloud(reg, target, target_features);
+    describe_cloud(reg, source, source_features);
+    coarse.setGravityConstrained(icp_type == "gravity" || icp_type == "gravity-refined");
+    if (!coarse.align(target_features, source_features)) {
+        return false;
+    }
+    pcl::transformPointCloudWithNormals(*source_sampled.cloud(), *source_sampled.cloud(), coarse.getFinalTransformation());
+    source_sampled.invalidate();
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+IncrementalRegistration::align(PreparedCloud &target, PreparedCloud &source, Eigen::Matrix4f &transformation_matrix)
+{
+    align_clouds(reg_, icp_type_, target, source, transformation_matrix);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+IncrementalRegistration::sample(PreparedCloud &cloud, PreparedCloud &sampled)
+{
+    sample_cloud(reg_, icp_type_, cloud, sampled);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+IncrementalRegistration::add(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr &fragment, const Eigen::Vector3f &translation)
+{
+    // The first point cloud is the map
+    if (poses_.empty()) {
+        add_registered(fragment, Eigen::Matrix4f::Identity(), PoseGraph::information_t::Zero());
+        return;
+    }
+    const std::size_t i = poses_.size();
 
-        // Prepare source cloud for alignment 
-        reg.normals_estimation(source);
-        reg.covariance_sampling(source, source_sampled);
-        if (icp_type == "non-linear") {
-            reg.alignment_icp_nl(target_sampled, source_sampled, transformation_matrix);
+    // Initial alignment: the submap in the frame of the previous fragment, moved by the odometry
+    Eigen::Matrix4f initial_transformation = Eigen::Matrix4f::Identity();
+    initial_transformation.col(3).head<3>() = translation;
+    submap(initial_transformation, *source_);
+
+    // Import new target cloud
+    pcl::copyPointCloud(*fragment, *target_);
+
+    // Align source and target
+    std::cout << "Fragment " << i - 1 << " and " << i << " to be aligned." << std::endl;
+    if (visualization_) {
+        reg_.visualize(target_, source_);
+        std::cout << "Close the visualization to align." << std::endl;
+    }
+
+    // Prepare both clouds for alignment
+    PreparedCloud target(target_);
+    PreparedCloud source(source_);
+    sample(target, target_sampled_);
+    sample(source, source_sampled_);
+
+    // Coarse alignment independent of the odometry, ICP starts from it if it is accepted
+    CoarseAlignment coarse;
+    if (coarse_alignment_) {
+        const bool accepted = coarse_align(reg_, icp_type_, target, source, source_sampled_, coarse);
+        std::cout << "Coarse alignment: " << coarse.getInliers() << " of " << coarse.getMatches()
+                  << " feature matches after " << coarse.getIterations() << " RANSAC iterations, "
+                  << (accepted ? "accepted" : "odometry kept") << std::endl;
+    }
+    Eigen::Matrix4f transformation_matrix = Eigen::Matrix4f::Identity();
+    align(target_sampled_, source_sampled_, transformation_matrix);
+
+    // Pose graph edge from the previous fragment, weighted by the final correspondences
+    PoseGraph::information_t information;
+    alignment_information(reg_, icp_type_, target_sampled_, source_sampled_, transformation_matrix, information);
+    transformation_matrix = transformation_matrix * coarse.getFinalTransformation();
+    add_registered(fragment, transformation_matrix * initial_transformation, information);
+    std::cout << "The alignment is completed" << std::endl;
+    if (visualization_) {
+        pcl::transformPointCloud(*source_, *source_, transformation_matrix);
+        reg_.visualize(target_, source_);
+        std::cout << "Close the visualization to procede." << std::endl;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+IncrementalRegistration::add_registered(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr &fragment,
+                                        const Eigen::Matrix4f &step,
+                                        const PoseGraph::information_t &information)
+{
+    // Only the fragments of the submap are kept, the map holds the others
+    if (submap_fragments_ > 0) {
+        recent_fragments_.push_back(fragment);
+        if (recent_fragments_.size() > submap_fragments_) {
+            recent_fragments_.pop_front();
         }
-        #if PCL_VERSION_COMPARE(>, 1, 10, 0)
-        else if (icp_type == "symmetric") {
-            reg.alignment_icp_symmetric(target_sampled, source_sampled, transformation_matrix);
+    }
+    if (poses_.empty()) {
+        poses_.push_back(Eigen::Matrix4f::Identity());
+        graph_.add_node(Eigen::Matrix4d::Identity());
+        map_.insert(*fragment);
+        return;
+    }
+    const std::size_t i = poses_.size();
+
+    // Move all registered fragments into the frame of the new one
+    for (std::size_t j = 0; j < poses_.size(); ++j) {
+        poses_[j] = step * poses_[j];
+    }
+    poses_.push_back(Eigen::Matrix4f::Identity());
+
+    const Eigen::Matrix4d relative = step.cast<double>().inverse();
+    graph_.add_node(graph_.pose(i - 1) * relative);
+    graph_.add_edge(i - 1, i, relative, information);
+    map_.insert(*fragment, graph_.pose(i).cast<float>());
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+IncrementalRegistration::add_loop_closure(std::size_t i,
+                                          std::size_t j,
+                                          const Eigen::Matrix4f &relative,
+                                          const PoseGraph::information_t &information)
+{
+    graph_.add_edge(i, j, relative.cast<double>(), information);
+    ++loop_closures_;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+std::size_t
+IncrementalRegistration::close_loops(const FragmentSource &fragments, std::size_t candidates)
+{
+    // Place recognition proposes the candidates, only those are aligned. The fragments are loaded
+    // one at a time for their descriptors.
+    PlaceIndex index;
+    for (std::size_t j = 0; j < poses_.size(); ++j) {
+        index.add(ScanContext(*fragments.load(static_cast<int>(j))));
+    }
+    const std::vector<PlaceIndex::Candidate> pairs = index.candidates(candidates);
+
+    // A fragment can be part of several candidates, its sample is prepared once in its own frame
+    std::vector<std::shared_ptr<PreparedCloud> > sampled(poses_.size());
+    const auto fragment_sample = [this, &fragments, &sampled](std::size_t j) -> PreparedCloud & {
+        if (!sampled[j]) {
+            sampled[j] = std::make_shared<PreparedCloud>(pcl::PointCloud<pcl::PointNormal>::Ptr(new pcl::PointCloud<pcl::PointNormal>));
+            pcl::copyPointCloud(*fragments.load(static_cast<int>(j)), *target_);
+            PreparedCloud fragment(target_);
+            sample(fragment, *sampled[j]);
         }
-        #endif
-        else {
-            if (icp_type != "generalized") {
-                std::cerr << "Unrecognized ICP type " << icp_type
-                          << " requested. Using generalized ICP instead." << std::endl;
-            }
-            reg.alignment_gicp(target_sampled, source_sampled, transformation_matrix);
+        return *sampled[j];
+    };
+
+    std::size_t closed = 0;
+    for (std::size_t c = 0; c < pairs.size(); ++c) {
+        const std::size_t i = pairs[c].i;
+        const std::size_t j = pairs[c].j;
+
+        // The older fragment i is moved into the frame of the newer fragment j as estimated by the
+        // sequential registration, so the information is expressed in the frame of the newer
+        // fragment like that of the sequential edges
+        const Eigen::Matrix4f initial_transformation = poses_[j].inverse() * poses_[i];
+        PreparedCloud &target = fragment_sample(j);
+        pcl::transformPointCloudWithNormals(*fragment_sample(i).cloud(), *source_sampled_.cloud(), initial_transformation);
+        source_sampled_.invalidate();
+
+        Eigen::Matrix4f transformation_matrix = Eigen::Matrix4f::Identity();
+        align(target, source_sampled_, transformation_matrix);
+
+        PoseGraph::information_t information;
+        const std::size_t correspondences =
+            alignment_information(reg_, icp_type_, target, source_sampled_, transformation_matrix, information);
+        const double overlap = static_cast<double>(correspondences) / std::max<std::size_t>(1, source_sampled_.size());
+        if (overlap < loop_closure_min_overlap) {
+            continue;
         }
+        std::cout << "Loop closure between fragment " << i << " and " << j << std::endl;
+        add_loop_closure(i, j, (transformation_matrix * initial_transformation).inverse(), information);
+        ++closed;
+    }
+    return closed;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+IncrementalRegistration::finish(const FragmentSource &fragments, const std::string &data_dir)
+{
+    // The chain of sequential edges is already consistent, only loop closures need the optimization
+    if (loop_closures_ > 0) {
+        std::cout << "Optimizing the pose graph with " << graph_.edges() << " edges...";
+        const int iterations = graph_.optimize();
+        std::cout << "Done after " << iterations << " iterations." << std::endl;
 
-        // Transform the source cloud and append the target cloud
-        pcl::transformPointCloud(*source, *source, transformation_matrix);
-        *source += *target;
-        std::cout << "The alignment is completed" << std::endl;
-        if (visualization) {
-            reg.visualize(target, source);
-            std::cout << "Close the visualization to procede." << std::endl;
+        const Eigen::Matrix4d newest = graph_.pose(graph_.size() - 1).inverse();
+        for (std::size_t j = 0; j < poses_.size(); ++j) {
+            poses_[j] = (newest * graph_.pose(j)).cast<float>();
         }
     }
 
-    pcl::io::savePCDFileBinary(data_dir + "/combined_cloud.pcd", *source);
+    // Assemble the whole map from the stored poses, loading the fragments one at a time
+    pcl::PointCloud<pcl::PointXYZ> combined_cloud;
+    if (map_resolution_ > 0 && loop_closures_ == 0) {
+        // Without loop closures the poses did not change since the fragments were inserted
+        map_.export_region(combined_cloud, graph_.pose(graph_.size() - 1).inverse().cast<float>());
+    } else if (map_resolution_ > 0) {
+        VoxelMap map(map_resolution_);
+        for (std::size_t j = 0; j < poses_.size(); ++j) {
+            map.insert(*fragments.load(static_cast<int>(j)), poses_[j]);
+        }
+        map.export_cloud(combined_cloud);
+    } else {
+        pcl::PointCloud<pcl::PointXYZ> transformed;
+        for (std::size_t j = 0; j < poses_.size(); ++j) {
+            pcl::transformPointCloud(*fragments.load(static_cast<int>(j)), transformed, poses_[j]);
+            combined_cloud += transformed;
+        }
+    }
+    pcl::io::savePCDFileBinary(data_dir + "/combined_cloud.pcd", combined_cloud);
 
     // Visualize all clouds combined
-    reg.visualize(source, nullptr);
+    pcl::copyPointCloud(combined_cloud, *source_);
+    reg_.visualize(source_, nullptr);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+PairwiseFragment::PairwiseFragment()
+    : sampled(pcl::PointCloud<pcl::PointNormal>::Ptr(new pcl::PointCloud<pcl::PointNormal>))
+{}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+prepare_pairwise_fragment(const std::string &icp_type,
+                          const pcl::PointCloud<pcl::PointXYZ> &fragment,
+                          PairwiseFragment &prepared,
+                          const bool coarse_alignment)
+{
+    Registration reg = fragment_registration();
+    PreparedCloud cloud(pcl::PointCloud<pcl::PointNormal>::Ptr(new pcl::PointCloud<pcl::PointNormal>));
+    pcl::copyPointCloud(fragment, *cloud.cloud());
+    sample_cloud(reg, icp_type, cloud, prepared.sampled);
+    if (coarse_alignment) {
+        describe_cloud(reg, cloud, prepared.features);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+pairwise_registration(const std::string &icp_type,
+                      const PairwiseFragment &previous,
+                      PairwiseFragment &fragment,
+                      const Eigen::Vector3f &translation,
+                      Eigen::Matrix4f &step,
+                      PoseGraph::information_t &information,
+                      const std::vector<PyramidLevel> &pyramid,
+                      const bool coarse_alignment)
+{
+    Registration reg = fragment_registration();
+    reg.set_pyramid(pyramid);
+    PreparedCloud &target_sampled = fragment.sampled;
+    PreparedCloud source_sampled(pcl::PointCloud<pcl::PointNormal>::Ptr(new pcl::PointCloud<pcl::PointNormal>));
+
+    // Initial alignment by the odometry, or by the coarse alignment of the features if it explains
+    // more matches. Normals, sample and features do not depend on it.
+    Eigen::Matrix4f initial_transformation = Eigen::Matrix4f::Identity();
+    initial_transformation.col(3).head<3>() = translation;
+    if (coarse_alignment) {
+        CoarseAlignment coarse;
+        coarse.setGravityConstrained(icp_type == "gravity" || icp_type == "gravity-refined");
+        coarse.align(fragment.features, previous.features, initial_transformation);
+        initial_transformation = coarse.getFinalTransformation();
+    }
+    pcl::transformPointCloudWithNormals(*previous.sampled.cloud(), *source_sampled.cloud(), initial_transformation);
+
+    Eigen::Matrix4f transformation_matrix = Eigen::Matrix4f::Identity();
+    align_clouds(reg, icp_type, target_sampled, source_sampled, transformation_matrix);
+    alignment_information(reg, icp_type, target_sampled, source_sampled, transformation_matrix, information);
+    step = transformation_matrix * initial_transformation;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+incremental_pairwise_registration(FragmentSource &fragments,
+                                  const std::vector<Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f> > &translations,
+                                  const std::string &data_dir,
+                                  const std::string &icp_type,
+                                  const bool visualization,
+                                  const unsigned submap_fragments,
+                                  const float submap_radius,
+                                  const float map_resolution,
+                                  const std::size_t loop_closures,
+                                  const std::vector<PyramidLevel> &pyramid,
+                                  const bool coarse_alignment)
+{
+    IncrementalRegistration registration(icp_type, visualization, submap_fragments, submap_radius, map_resolution);
+    registration.set_pyramid(pyramid);
+    registration.set_coarse_alignment(coarse_alignment);
+    registration.add(fragments.get(0), Eigen::Vector3f::Zero());
+
+    // Align all other point clouds pairwise
+    for (int i = 1; i < fragments.size(); ++i) {
+        registration.add(fragments.get(i), translations[i - 1]);
+    }
+    if (loop_closures > 0) {
+        registration.close_loops(fragments, loop_closures);
+    }
+    registration.finish(fragments, data_dir);
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <deque>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -11,14 +13,175 @@
 
 #include <pcl/point_cloud.h>
 
+#include "coarse_alignment.h"
+#include "fragment_source.h"
+#include "pose_graph.h"
+#include "registration.h"
+#include "scan_stream.h"
+#include "voxel_map.h"
+
 ///////////////////////////////////////////////////////////////
+// Alignment of consecutive odometry scans: non-linear ICP on the sampled scans, ICP with projective
+// data association on the range images, or ICP on the edge and planar features of the range images
+enum OdometryMethod { ICP_ODOMETRY, PROJECTIVE_ODOMETRY, FEATURE_ODOMETRY };
+
+// Sums the translations between consecutive scans, consuming the stream until it is closed. With
+// ICP_ODOMETRY the scan pairs are aligned concurrently on `threads` threads (0: one per hardware
+// thread), the range image methods align them one after the other, each starting from the motion
+// of the previous pair. The pairs are reduced in scan order. With compose the full
+// transformations are chained and the translation of the chain is returned.
+void
+translation_estimation(ScanStream &scans,
+                       Eigen::Vector3f &translation,
+                       const bool compose = false,
+                       const unsigned threads = 0,
+                       const OdometryMethod method = ICP_ODOMETRY);
+
+// Registers fragments one by one against a map of the previous fragments. Only the poses of the
+// fragments in the frame of the newest fragment are kept, the loop closures and the final map
+// reload the fragments one at a time. Every registered fragment is also inserted once into a voxel map in
+// the frame of the first fragment (map_resolution, or 5 cm if it is 0), and a new fragment is
+// aligned with the voxels of that map, with submap_radius > 0 only with those within that radius of
+// its expected position. With submap_fragments > 0 it is aligned with the last submap_fragments
+// fragments instead. Both limits bound the cost of a step, so the registration time grows linearly
+// with the number of fragments instead of quadratically. With map_resolution > 0 the final map also
+// keeps one point per voxel, so overlapping fragments are not stored several times.
+class IncrementalRegistration
+{
+public:
+    IncrementalRegistration(const std::string &icp_type,
+                            const bool visualization,
+                            const unsigned submap_fragments = 0,
+                            const float submap_radius = 0,
+                            const float map_resolution = 0);
+
+    // The first fragment starts the map. Every further fragment is aligned with the map, which is
+    // first moved by the odometry translation between the previous fragment and this one.
+    void
+    add(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr &fragment, const Eigen::Vector3f &translation);
+
+    // Adds a fragment that was already registered with the previous one: `step` moves the previous
+    // fragment into the frame of this one
+    void
+    add_registered(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr &fragment,
+                   const Eigen::Matrix4f &step,
+                   const PoseGraph::information_t &information);
+
+    // Coarse-to-fine alignment, see Registration::set_pyramid
+    void
+    set_pyramid(const std::vector<PyramidLevel> &pyramid) { reg_.set_pyramid(pyramid); }
+
+    // Starts every alignment from the FPFH and RANSAC alignment of the clouds instead of the odometry
+    // where it explains more feature matches, see CoarseAlignment
+    void
+    set_coarse_alignment(bool coarse_alignment) { coarse_alignment_ = coarse_alignment; }
+
+    std::size_t size() const { return poses_.size(); }
+
+    // Adds a non-sequential constraint: `relative` is the pose of fragment j in the frame of
+    // fragment i and, like for the sequential edges, the information is expressed in the frame of
+    // the newer fragment j. With loop closures the poses are optimized as a pose graph before the
+    // map is assembled.
+    void
+    add_loop_closure(std::size_t i,
+                     std::size_t j,
+                     const Eigen::Matrix4f &relative,
+                     const PoseGraph::information_t &information);
+
+    // Searches the registered fragments for up to `candidates` revisited places with scan context
+    // descriptors, verifies them with ICP and adds the accepted ones as loop closures. Returns the
+    // number of loop closures added. `fragments` holds the registered fragments in their order.
+    std::size_t
+    close_loops(const FragmentSource &fragments, std::size_t candidates);
+
+    // Saves combined_cloud.pcd and shows it. Must be called from the main thread.
+    void
+    finish(const FragmentSource &fragments, const std::string &data_dir);
+
+private:
+    // Aligns source with target using the requested ICP variant
+    void
+    align(PreparedCloud &target, PreparedCloud &source, Eigen::Matrix4f &transformation_matrix);
+
+    // Fills sampled with the sample of cloud that the ICP variant aligns
+    void
+    sample(PreparedCloud &cloud, PreparedCloud &sampled);
+
+    // The submap of the registered fragments, transformed by `transformation`
+    void
+    submap(const Eigen::Matrix4f &transformation, pcl::PointCloud<pcl::PointNormal> &cloud) const;
+
+    Registration reg_;
+    std::string icp_type_;
+    bool visualization_;
+    unsigned submap_fragments_;
+    float submap_radius_;
+    float map_resolution_;
+    bool coarse_alignment_;
+
+    // Registered fragments in the frame of the first fragment
+    VoxelMap map_;
+
+    // Poses of the registered fragments in the frame of the newest fragment, and the last
+    // submap_fragments fragments, oldest first
+    std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f> > poses_;
+    std::deque<pcl::PointCloud<pcl::PointXYZ>::ConstPtr> recent_fragments_;
+
+    // Fragment poses in the frame of the first fragment with the pairwise registrations as edges
+    PoseGraph graph_;
+    std::size_t loop_closures_;
+
+    // Data variables
+    pcl::PointCloud<pcl::PointNormal>::Ptr target_;
+    pcl::PointCloud<pcl::PointNormal>::Ptr source_;
+    PreparedCloud target_sampled_;
+    PreparedCloud source_sampled_;
+};
+
+// A fragment prepared for pairwise_registration in its own frame: its covariance sample with
+// normals, or its voxel grid for VGICP, and for the coarse alignment the features of the whole
+// fragment. Both pairs of a fragment use it, so every fragment is loaded and prepared once.
+struct PairwiseFragment
+{
+    typedef std::shared_ptr<PairwiseFragment> Ptr;
+
+    PairwiseFragment();
+
+    PreparedCloud sampled;
+    CoarseAlignment::Features features;
+};
+
+void
+prepare_pairwise_fragment(const std::string &icp_type,
+                          const pcl::PointCloud<pcl::PointXYZ> &fragment,
+                          PairwiseFragment &prepared,
+                          const bool coarse_alignment = false);
+
+// Registers fragment `previous` with the following `fragment` independently of all other fragments,
+// starting from the odometry translation. `step` moves the previous fragment into the frame of the
+// fragment. Pairs can run concurrently and be composed with IncrementalRegistration::add_registered.
+// The previous fragment is only read, so it may be the `fragment` of a concurrent pair. The coarse
+// alignment needs both fragments prepared with their features.
 void
-translation_estimation(const std::string path, Eigen::Vector3f &translation);
+pairwise_registration(const std::string &icp_type,
+                      const PairwiseFragment &previous,
+                      PairwiseFragment &fragment,
+                      const Eigen::Vector3f &translation,
+                      Eigen::Matrix4f &step,
+                      PoseGraph::information_t &information,
+                      const std::vector<PyramidLevel> &pyramid = std::vector<PyramidLevel>(),
+                      const bool coarse_alignment = false);
 
 void
-incremental_pairwise_registration(const std::vector<pcl::PointCloud<pcl::PointXYZ> > &clouds,
+incremental_pairwise_registration(FragmentSource &fragments,
                                   const std::vector<Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f> > &translations,
                                   const std::string &data_dir,
                                   const std::string &icp_type,
-                                  const bool visualization);
+                                  const bool visualization,
+                                  const unsigned submap_fragments = 0,
+                                  const float submap_radius = 0,
+                                  const float map_resolution = 0,
+                                  const std::size_t loop_closures = 0,
+                                  const std::vector<PyramidLevel> &pyramid = std::vector<PyramidLevel>(),
+                                  const bool coarse_alignment = false);
 //////////////////////////////////////////////////////////////
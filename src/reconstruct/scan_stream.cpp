@@ -0,0 +1,117 @@
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <pcl/io/pcd_io.h>
+
+#include <boost/filesystem.hpp>
+
+#include "scan_stream.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+AsyncScanWriter::AsyncScanWriter(const std::string directory)
+    : directory_{directory},
+      queue_{scan_stream_capacity}
+{
+    boost::filesystem::create_directories(directory_);
+    thread_ = std::thread(&AsyncScanWriter::run, this);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+AsyncScanWriter::~AsyncScanWriter()
+{
+    queue_.close();
+    thread_.join();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+AsyncScanWriter::write(int index, const scan_t::ConstPtr &scan)
+{
+    queue_.push(std::make_pair(index, scan));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+AsyncScanWriter::run()
+{
+    std::pair<int, scan_t::ConstPtr> item;
+    while (queue_.pop(item)) {
+        pcl::io::savePCDFileBinary(directory_ + "/scan_" + std::to_string(item.first) + ".pcd", *item.second);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+KeyframeSelector::KeyframeSelector(ScanStream &scans, const float min_displacement)
+    : scans_(scans),
+      min_displacement_{min_displacement},
+      holding_{false},
+      bridge_valid_{true},
+      scans_count_{0},
+      keyframes_count_{0}
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+KeyframeSelector::push(const Scan &scan)
+{
+    ++scans_count_;
+    const bool keyframe = min_displacement_ <= 0 || !keyframe_ || !scan.image
+                       || keyframe_->displacement(*scan.image) >= min_displacement_;
+    if (holding_) {
+        drop(held_);
+        held_ = Scan();
+        holding_ = false;
+    }
+    if (keyframe) {
+        emit(scan);
+    } else {
+        held_ = scan;
+        holding_ = true;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+KeyframeSelector::close()
+{
+    if (holding_) {
+        holding_ = false;
+        emit(held_);
+        held_ = Scan();
+    }
+    scans_.close();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+KeyframeSelector::drop(const Scan &scan)
+{
+    if (!scan.motion) {
+        bridge_valid_ = false;
+    } else if (!bridge_) {
+        bridge_.reset(new ImuPreintegration(*scan.motion));
+    } else {
+        bridge_->append(*scan.motion);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+KeyframeSelector::emit(Scan scan)
+{
+    if (bridge_ || !bridge_valid_) {
+        if (bridge_valid_ && scan.motion) {
+            bridge_->append(*scan.motion);
+            scan.motion = bridge_;
+        } else {
+            scan.motion.reset();
+        }
+        bridge_.reset();
+        bridge_valid_ = true;
+    }
+    keyframe_ = scan.image;
+    ++keyframes_count_;
+    scans_.push(scan);
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "blocking_queue.h"
+#include "imu_preintegration.h"
+#include "range_image.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Odometry scans are handed from combine_datapackets_to_scans to translation_estimation in memory.
+// Scan i is pushed as soon as it is combined; the producer closes the stream after the last scan.
+typedef pcl::PointCloud<pcl::PointXYZ> scan_t;
+
+// A scan with the range image of its returns, which is empty for captures without VLP-16 rings,
+// and the IMU motion since the middle of the previous scan, which is empty for the first scan and
+// for captures without IMU data
+struct Scan
+{
+    scan_t::ConstPtr cloud;
+    RangeImage::ConstPtr image;
+    ImuPreintegration::ConstPtr motion;
+};
+typedef BlockingQueue<Scan> ScanStream;
+
+// Scans buffered between combining and registration
+constexpr std::size_t scan_stream_capacity = 8;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Passes the keyframes of the odometry scans on to a stream. A scan becomes a keyframe once its
+// returns moved more than min_displacement from the last keyframe (RangeImage::displacement), so
+// while the operator stands still no scans are registered. The scans in between are dropped and
+// their IMU motion is prepended to the next keyframe's, so a keyframe pair bridges them. The last
+// scan is always a keyframe, so the keyframes span the whole run. Scans without a range image are
+// always keyframes. With min_displacement 0 every scan is a keyframe.
+class KeyframeSelector
+{
+public:
+    KeyframeSelector(ScanStream &scans, const float min_displacement);
+
+    void
+    push(const Scan &scan);
+
+    // Passes on the last scan if it was held back and closes the stream
+    void
+    close();
+
+    std::size_t scans() const { return scans_count_; }
+    std::size_t keyframes() const { return keyframes_count_; }
+
+private:
+    // Adds the motion of a dropped scan to the bridge
+    void
+    drop(const Scan &scan);
+
+    void
+    emit(Scan scan);
+
+    ScanStream &scans_;
+    float min_displacement_;
+    RangeImage::ConstPtr keyframe_;
+
+    // Last scan that is not a keyframe, it becomes one if the stream ends
+    Scan held_;
+    bool holding_;
+
+    // IMU motion of the dropped scans, invalid if one of them had none
+    std::shared_ptr<ImuPreintegration> bridge_;
+    bool bridge_valid_;
+
+    std::size_t scans_count_;
+    std::size_t keyframes_count_;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Writes scans to <directory>/scan_<i>.pcd on a background thread. The destructor waits until all
+// queued scans are written.
+class AsyncScanWriter
+{
+public:
+    explicit AsyncScanWriter(const std::string directory);
+    ~AsyncScanWriter();
+
+    void
+    write(int index, const scan_t::ConstPtr &scan);
+
+private:
+    void
+    run();
+
+    std::string directory_;
+    BlockingQueue<std::pair<int, scan_t::ConstPtr> > queue_;
+    std::thread thread_;
+};
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,90 @@
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "task_graph.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+TaskGraph::node_t
+TaskGraph::add(const std::string &name, std::function<void()> task, const std::vector<node_t> &dependencies)
+{
+    const node_t node = nodes_.size();
+    nodes_.push_back(std::unique_ptr<Node>(new Node));
+    nodes_[node]->name = name;
+    nodes_[node]->task = std::move(task);
+    nodes_[node]->dependencies = dependencies.size();
+    for (std::size_t i = 0; i < dependencies.size(); ++i) {
+        nodes_[dependencies[i]]->dependents.push_back(node);
+    }
+    return node;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+TaskGraph::run(ThreadPool &pool)
+{
+    finished_ = 0;
+    error_ = nullptr;
+    for (std::size_t i = 0; i < nodes_.size(); ++i) {
+        nodes_[i]->remaining = nodes_[i]->dependencies;
+        nodes_[i]->skip = false;
+    }
+    for (std::size_t i = 0; i < nodes_.size(); ++i) {
+        if (nodes_[i]->dependencies == 0) {
+            launch(pool, i);
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    all_done_.wait(lock, [this] { return finished_ == nodes_.size(); });
+    if (error_) {
+        std::rethrow_exception(error_);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+TaskGraph::launch(ThreadPool &pool, node_t node)
+{
+    pool.submit([this, &pool, node]() {
+        Node &n = *nodes_[node];
+        if (!n.skip) {
+            try {
+                n.task();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                std::cerr << "Task " << n.name << " failed, skipping the tasks depending on it." << std::endl;
+                if (!error_) {
+                    error_ = std::current_exception();
+                }
+                n.skip = true;
+            }
+        }
+        finish(pool, node);
+    });
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+TaskGraph::finish(ThreadPool &pool, node_t node)
+{
+    const Node &n = *nodes_[node];
+    for (std::size_t i = 0; i < n.dependents.size(); ++i) {
+        Node &dependent = *nodes_[n.dependents[i]];
+        if (n.skip) {
+            dependent.skip = true;
+        }
+        if (--dependent.remaining == 0) {
+            launch(pool, n.dependents[i]);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (++finished_ == nodes_.size()) {
+        all_done_.notify_all();
+    }
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
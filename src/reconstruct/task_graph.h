@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "thread_pool.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Directed acyclic graph of tasks. A node is submitted to the thread pool as soon as all of its
+// dependencies have finished, so independent chains run concurrently and the wall time approaches
+// the critical path. If a task throws, the nodes depending on it are skipped and run() rethrows
+// the first exception after all other nodes have finished.
+class TaskGraph
+{
+public:
+    typedef std::size_t node_t;
+
+    // Dependencies must have been added before
+    node_t
+    add(const std::string &name, std::function<void()> task, const std::vector<node_t> &dependencies = std::vector<node_t>());
+
+    std::size_t size() const { return nodes_.size(); }
+
+    // Executes the graph on the pool and blocks until every node has finished or was skipped
+    void
+    run(ThreadPool &pool);
+
+private:
+    struct Node
+    {
+        std::string name;
+        std::function<void()> task;
+        std::vector<node_t> dependents;
+        std::size_t dependencies;
+        std::atomic<std::size_t> remaining;
+        std::atomic<bool> skip;
+    };
+
+    void
+    launch(ThreadPool &pool, node_t node);
+
+    void
+    finish(ThreadPool &pool, node_t node);
+
+    std::vector<std::unique_ptr<Node> > nodes_;
+
+    std::mutex mutex_;
+    std::condition_variable all_done_;
+    std::size_t finished_;
+    std::exception_ptr error_;
+};
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include <unistd.h>
+
+#include "thread_pool.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Index of the pool worker running on this thread, -1 on other threads
+static thread_local int current_worker = -1;
+static thread_local const ThreadPool *current_pool = nullptr;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ThreadPool::ThreadPool(unsigned threads)
+    : pending_{0},
+      next_{0},
+      stop_{false}
+{
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned i = 0; i < threads; ++i) {
+        workers_.push_back(std::unique_ptr<Worker>(new Worker));
+    }
+    for (unsigned i = 0; i < threads; ++i) {
+        threads_.push_back(std::thread(&ThreadPool::run, this, i));
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (std::size_t i = 0; i < threads_.size(); ++i) {
+        threads_[i].join();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+ThreadPool::enqueue(std::function<void()> task)
+{
+    const unsigned worker = (current_pool == this && current_worker >= 0)
+                          ? static_cast<unsigned>(current_worker)
+                          : next_++ % workers_.size();
+    // Counted before it is published, so a concurrent try_pop never takes pending_ below zero. A
+    // worker woken in between finds no task yet and retries until it is pushed.
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++pending_;
+    }
+    {
+        std::lock_guard<std::mutex> lock(workers_[worker]->mutex);
+        workers_[worker]->tasks.push_back(std::move(task));
+    }
+    wake_.notify_one();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool
+ThreadPool::try_pop(unsigned worker, std::function<void()> &task)
+{
+    // Own tasks, newest first
+    {
+        std::lock_guard<std::mutex> lock(workers_[worker]->mutex);
+        if (!workers_[worker]->tasks.empty()) {
+            task = std::move(workers_[worker]->tasks.back());
+            workers_[worker]->tasks.pop_back();
+            --pending_;
+            return true;
+        }
+    }
+    // Steal the oldest task of another worker
+    for (std::size_t k = 1; k < workers_.size(); ++k) {
+        Worker &victim = *workers_[(worker + k) % workers_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            --pending_;
+            return true;
+        }
+    }
+    return false;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+ThreadPool::run(unsigned worker)
+{
+    current_worker = static_cast<int>(worker);
+    current_pool = this;
+    std::function<void()> task;
+    while (true) {
+        if (try_pop(worker, task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [this] { return stop_ || pending_ > 0; });
+        if (stop_ && pending_ == 0) {
+            return;
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+MemoryBudget::MemoryBudget(std::size_t bytes)
+    : limit_{bytes},
+      used_{0}
+{
+    if (limit_ == 0) {
+        const long pages = sysconf(_SC_PHYS_PAGES);
+        const long page_size = sysconf(_SC_PAGESIZE);
+        limit_ = (pages > 0 && page_size > 0)
+               ? static_cast<std::size_t>(pages) * static_cast<std::size_t>(page_size) / 4 * 3
+               : static_cast<std::size_t>(8) << 30;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+MemoryBudget::acquire(std::size_t bytes)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    released_.wait(lock, [this, bytes] { return used_ == 0 || used_ + bytes <= limit_; });
+    used_ += bytes;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+MemoryBudget::release(std::size_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        used_ -= std::min(bytes, used_);
+    }
+    released_.notify_all();
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
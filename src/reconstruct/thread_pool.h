@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Work-stealing thread pool. Every worker owns a task deque: tasks submitted from a worker go to
+// the back of its own deque and are taken LIFO, tasks submitted from outside are distributed round
+// robin. An idle worker steals from the front of the other deques. The destructor runs all
+// submitted tasks before it joins the workers.
+class ThreadPool
+{
+public:
+    // threads == 0 uses one thread per hardware thread
+    explicit ThreadPool(unsigned threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    unsigned size() const { return static_cast<unsigned>(threads_.size()); }
+
+    template <typename F>
+    std::future<typename std::result_of<F()>::type>
+    submit(F function)
+    {
+        typedef typename std::result_of<F()>::type result_t;
+        std::shared_ptr<std::packaged_task<result_t()> > task =
+            std::make_shared<std::packaged_task<result_t()> >(std::move(function));
+        std::future<result_t> result = task->get_future();
+        enqueue([task]() { (*task)(); });
+        return result;
+    }
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()> > tasks;
+    };
+
+    void
+    enqueue(std::function<void()> task);
+
+    bool
+    try_pop(unsigned worker, std::function<void()> &task);
+
+    void
+    run(unsigned worker);
+
+    std::vector<std::unique_ptr<Worker> > workers_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::atomic<std::size_t> pending_;
+    std::atomic<unsigned> next_;
+    bool stop_;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Admission control for memory hungry tasks. acquire() blocks until the requested number of bytes
+// fits into the budget. A request larger than the whole budget is admitted when nothing else is
+// running, so it is serialized instead of blocking forever.
+class MemoryBudget
+{
+public:
+    // bytes == 0 uses three quarters of the physical memory
+    explicit MemoryBudget(std::size_t bytes = 0);
+
+    void
+    acquire(std::size_t bytes);
+
+    void
+    release(std::size_t bytes);
+
+    std::size_t limit() const { return limit_; }
+
+private:
+    std::size_t limit_;
+    std::size_t used_;
+    std::mutex mutex_;
+    std::condition_variable released_;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Holds bytes of a MemoryBudget for the lifetime of the object
+class MemoryReservation
+{
+public:
+    MemoryReservation(MemoryBudget &budget, std::size_t bytes)
+        : budget_(budget), bytes_{bytes}
+    {
+        budget_.acquire(bytes_);
+    }
+
+    ~MemoryReservation()
+    {
+        budget_.release(bytes_);
+    }
+
+    MemoryReservation(const MemoryReservation &) = delete;
+    MemoryReservation &operator=(const MemoryReservation &) = delete;
+
+private:
+    MemoryBudget &budget_;
+    std::size_t bytes_;
+};
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,79 @@
+#include <cstddef>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RECO_HAVE_AVX2_KERNEL
+#include <immintrin.h>
+#endif
+
+#include "transform_kernel.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+static void
+transform_points_scalar(const float *input, float *output, std::size_t n, std::size_t stride, const float m[12])
+{
+    for (std::size_t i = 0; i < n; ++i, input += stride, output += stride) {
+        const float x = input[0], y = input[1], z = input[2];
+        if (output != input) {
+            std::memcpy(output + 3, input + 3, (stride - 3) * sizeof(float));
+        }
+        output[0] = m[0] * x + m[1] * y + m[2]  * z + m[3];
+        output[1] = m[4] * x + m[5] * y + m[6]  * z + m[7];
+        output[2] = m[8] * x + m[9] * y + m[10] * z + m[11];
+    }
+}
+
+#ifdef RECO_HAVE_AVX2_KERNEL
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Two points per iteration for 32 byte points (PointXYZL, PointXYZI, ...): the x, y, z, 1 halves
+// of both points are packed into one register, each coordinate is broadcast within its lane and
+// the result is the sum of the matrix columns weighted by the coordinates.
+__attribute__((target("avx2,fma"))) static void
+transform_points_avx2(const float *input, float *output, std::size_t n, const float m[12])
+{
+    const __m128 c0 = _mm_setr_ps(m[0], m[4], m[8],  0.0f);
+    const __m128 c1 = _mm_setr_ps(m[1], m[5], m[9],  0.0f);
+    const __m128 c2 = _mm_setr_ps(m[2], m[6], m[10], 0.0f);
+    const __m128 c3 = _mm_setr_ps(m[3], m[7], m[11], 1.0f);
+    const __m256 col0 = _mm256_set_m128(c0, c0);
+    const __m256 col1 = _mm256_set_m128(c1, c1);
+    const __m256 col2 = _mm256_set_m128(c2, c2);
+    const __m256 col3 = _mm256_set_m128(c3, c3);
+
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2, input += 16, output += 16) {
+        const __m256 p0 = _mm256_loadu_ps(input);
+        const __m256 p1 = _mm256_loadu_ps(input + 8);
+        const __m256 xyz = _mm256_permute2f128_ps(p0, p1, 0x20);
+        __m256 r = _mm256_fmadd_ps(_mm256_permute_ps(xyz, 0x00), col0, col3);
+        r = _mm256_fmadd_ps(_mm256_permute_ps(xyz, 0x55), col1, r);
+        r = _mm256_fmadd_ps(_mm256_permute_ps(xyz, 0xAA), col2, r);
+        _mm256_storeu_ps(output,     _mm256_permute2f128_ps(r, p0, 0x30));
+        _mm256_storeu_ps(output + 8, _mm256_permute2f128_ps(r, p1, 0x31));
+    }
+    if (i < n) {
+        transform_points_scalar(input, output, n - i, 8, m);
+    }
+}
+
+static bool
+cpu_has_avx2()
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return avx2;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+transform_points(const float *input, float *output, std::size_t n, std::size_t stride, const float matrix[12])
+{
+#ifdef RECO_HAVE_AVX2_KERNEL
+    if (stride == 8 && cpu_has_avx2()) {
+        transform_points_avx2(input, output, n, matrix);
+        return;
+    }
+#endif
+    transform_points_scalar(input, output, n, stride, matrix);
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
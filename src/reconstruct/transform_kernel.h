@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Rigid transformation of points stored in PCL layout: every point is `stride` floats wide
+// and starts with x, y, z, 1 (PCL_ADD_POINT4D). The remaining floats of a point (label,
+// padding) are copied unchanged. `matrix` is the upper 3x4 block of the transformation,
+// row major. Input and output may be the same buffer but must not overlap otherwise.
+// This header deliberately does not include Eigen: the AVX2 path is compiled with a
+// function level target attribute and must not change the alignment of Eigen types.
+void
+transform_points(const float *input, float *output, std::size_t n, std::size_t stride, const float matrix[12]);
+/////////////////////////////////////////////////////////////////////////////////////////////
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <vector>
 
 #if defined __GNUC__ || defined __APPLE__
@@ -6,14 +7,19 @@
 #include <eigen3/Eigen/Dense>
 #endif
 
+#include "transformation.h"
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////
 void
 make_rotation_matrix_from_quaternion(const Eigen::Vector4d &quaternion, Eigen::Matrix3d &rotation_matrix)
 {
-    double qw = quaternion(0), qx = quaternion(1), qy = quaternion(2), qz = quaternion(3);
-    rotation_matrix << 1 - 2 * pow(qy, 2) - 2 * pow(qz, 2), 2 * qx * qy - 2 * qz * qw, 2 * qx * qz + 2 * qy * qw,
-        2 * qx * qy + 2 * qz * qw, 1 - 2 * pow(qx, 2) - 2 * pow(qz, 2), 2 * qy * qz - 2 * qx * qw,
-        2 * qx * qz - 2 * qy * qw, 2 * qy * qz + 2 * qx * qw, 1 - 2 * pow(qx, 2) - 2 * pow(qy, 2);
+    const double qw = quaternion(0), qx = quaternion(1), qy = quaternion(2), qz = quaternion(3);
+    const double xx = qx * qx, yy = qy * qy, zz = qz * qz;
+    const double xy = qx * qy, xz = qx * qz, yz = qy * qz;
+    const double wx = qw * qx, wy = qw * qy, wz = qw * qz;
+    rotation_matrix << 1 - 2 * (yy + zz), 2 * (xy - wz), 2 * (xz + wy),
+        2 * (xy + wz), 1 - 2 * (xx + zz), 2 * (yz - wx),
+        2 * (xz - wy), 2 * (yz + wx), 1 - 2 * (xx + yy);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -25,21 +31,38 @@ make_translation_vector(const Eigen::Matrix3d rotation, Eigen::Vector3d &tripod_
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
-std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d> >
-make_transformation_matrices(const std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > &quaternions)
+void
+make_transformation_matrix(const Eigen::Vector4d &quaternion, float matrix[12])
 {
-    std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d> > matrices;
     Eigen::Matrix3d tripod_rotation;
     Eigen::Vector3d tripod_position;
-    for (std::size_t i = 0; i < quaternions.size(); ++i) {
-        make_rotation_matrix_from_quaternion(quaternions[i], tripod_rotation);
-        make_translation_vector(tripod_rotation, tripod_position);
-        Eigen::Matrix4d matrix = Eigen::Matrix4d::Identity();
-        matrix.topLeftCorner<3, 3>() = tripod_rotation;
-        matrix.col(3).head<3>() = tripod_position;
-        matrices.push_back(matrix);
+    make_rotation_matrix_from_quaternion(quaternion, tripod_rotation);
+    make_translation_vector(tripod_rotation, tripod_position);
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c) {
+            matrix[4 * r + c] = static_cast<float>(tripod_rotation(r, c));
+        }
+        matrix[4 * r + 3] = static_cast<float>(tripod_position(r));
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+make_leveling_rotation(const std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > &quaternions,
+                       const std::vector<Eigen::Vector3d> &gravity,
+                       Eigen::Matrix3d &leveling)
+{
+    Eigen::Vector3d up = Eigen::Vector3d::Zero();
+    for (std::size_t i = 0; i < std::min(quaternions.size(), gravity.size()); ++i) {
+        Eigen::Matrix3d rotation;
+        make_rotation_matrix_from_quaternion(quaternions[i], rotation);
+        up += rotation * gravity[i];
+    }
+    if (up.norm() == 0) {
+        leveling.setIdentity();
+        return;
     }
-    return matrices;
+    leveling = Eigen::Quaterniond::FromTwoVectors(up, Eigen::Vector3d::UnitZ()).toRotationMatrix();
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -9,6 +9,20 @@
 #endif
 
 /////////////////////////////////////////////////////////////////////////////////////////////
-std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d> >
-make_transformation_matrices(const std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > &quaternions);
+// Rotation matrix of a unit quaternion (w, x, y, z)
+void
+make_rotation_matrix_from_quaternion(const Eigen::Vector4d &quaternion, Eigen::Matrix3d &rotation_matrix);
+
+// Upper 3x4 block (row major) of the tripod transformation for one quaternion (w, x, y, z),
+// in the layout expected by transform_points().
+void
+make_transformation_matrix(const Eigen::Vector4d &quaternion, float matrix[12]);
+
+// Rotation that levels a capture: it turns the mean gravity of the datapackets, each rotated into
+// the capture frame with its quaternion, onto +z. The IMU reports gravity as the accelerometer
+// sees it, pointing up. The identity if no gravity was recorded.
+void
+make_leveling_rotation(const std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > &quaternions,
+                       const std::vector<Eigen::Vector3d> &gravity,
+                       Eigen::Matrix3d &leveling);
 /////////////////////////////////////////////////////////////////////////////////////////////
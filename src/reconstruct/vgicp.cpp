@@ -0,0 +1,219 @@
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <pcl/common/transforms.h>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+#include "vgicp.h"
+
+// A voxel needs this many points for a covariance
+constexpr std::uint32_t vgicp_min_voxel_points = 5;
+
+// Eigenvalue of the surface normal direction of a regularized covariance, the others are 1
+constexpr double vgicp_plane_epsilon = 1e-3;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Covariance of a plane with the orientation of `covariance`, like GICP
+static Eigen::Matrix3d
+plane_covariance(const Eigen::Matrix3d &covariance)
+{
+    const Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(covariance);
+    const Eigen::Vector3d values(vgicp_plane_epsilon, 1, 1);
+    return solver.eigenvectors() * values.asDiagonal() * solver.eigenvectors().transpose();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+VoxelCovariances::VoxelCovariances(const pcl::PointCloud<pcl::PointNormal> &cloud, float resolution)
+    : voxels(resolution, true)
+{
+    voxels.insert(cloud);
+    covariances.resize(voxels.size());
+    for (std::size_t v = 0; v < voxels.size(); ++v) {
+        covariances[v] = voxels.count(v) >= vgicp_min_voxel_points
+                       ? plane_covariance(voxels.covariance(v))
+                       : Eigen::Matrix3d::Constant(std::numeric_limits<double>::quiet_NaN());
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+VoxelizedGICP::VoxelizedGICP()
+    : transformation_epsilon_{0},
+      euclidean_fitness_epsilon_{-std::numeric_limits<double>::max()},
+      maximum_iterations_{10},
+      resolution_{1},
+      source_prepared_{false},
+      transformation_(Eigen::Matrix4f::Identity()),
+      converged_{false}
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+VoxelizedGICP::setMaxCorrespondenceDistance(double distance)
+{
+    if (static_cast<float>(distance) != resolution_) {
+        resolution_ = static_cast<float>(distance);
+        source_prepared_ = false;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+VoxelizedGICP::setInputTarget(const cloud_t::ConstPtr &target)
+{
+    if (target != target_) {
+        target_ = target;
+        target_voxels_.reset();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+VoxelizedGICP::setInputTarget(const cloud_t::ConstPtr &target, const VoxelCovariances::ConstPtr &voxels)
+{
+    target_ = target;
+    target_voxels_ = voxels;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+VoxelizedGICP::setInputSource(const cloud_t::ConstPtr &source)
+{
+    if (source != source_) {
+        source_ = source;
+        source_prepared_ = false;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+VoxelizedGICP::prepare()
+{
+    if (!target_voxels_ || target_voxels_->voxels.resolution() != resolution_) {
+        target_voxels_ = std::make_shared<VoxelCovariances>(*target_, resolution_);
+    }
+
+    if (!source_prepared_) {
+        const VoxelCovariances source_voxels(*source_, resolution_);
+        source_covariances_.resize(source_->size());
+        for (std::size_t i = 0; i < source_->size(); ++i) {
+            const std::ptrdiff_t v = source_voxels.voxels.find(source_->points[i].getVector3fMap());
+            source_covariances_[i] = v >= 0 ? source_voxels.covariances[v]
+                                            : Eigen::Matrix3d::Constant(std::numeric_limits<double>::quiet_NaN());
+        }
+        source_prepared_ = true;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+NormalEquations
+VoxelizedGICP::linearize(const Eigen::Matrix4f &transformation) const
+{
+    const Eigen::Matrix3d rotation = transformation.topLeftCorner<3, 3>().cast<double>();
+    const Eigen::Vector3d translation = transformation.col(3).head<3>().cast<double>();
+    const long n = static_cast<long>(source_->size());
+
+    NormalEquations system;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) reduction(+:system)
+#endif
+    for (long i = 0; i < n; ++i) {
+        if (!source_covariances_[i].allFinite()) {
+            continue;
+        }
+        const Eigen::Vector3d p = rotation * source_->points[i].getVector3fMap().cast<double>() + translation;
+        const std::ptrdiff_t v = target_voxels_->voxels.find(p.cast<float>());
+        if (v < 0 || !target_voxels_->covariances[v].allFinite()) {
+            continue;
+        }
+
+        // Distribution to distribution residual, a small motion (t, r) moves p by t - [p]x r
+        const Eigen::Vector3d residual = target_voxels_->voxels.mean(v) - p;
+        const Eigen::Matrix3d information =
+            (target_voxels_->covariances[v] + rotation * source_covariances_[i] * rotation.transpose()).inverse();
+        Eigen::Matrix<double, 3, 6> J;
+        J.leftCols<3>() = -Eigen::Matrix3d::Identity();
+        J.rightCols<3>() << 0, -p.z(), p.y(),
+                            p.z(), 0, -p.x(),
+                            -p.y(), p.x(), 0;
+        system.add(J, residual, information);
+    }
+    return system;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+VoxelizedGICP::align(cloud_t &output)
+{
+    align(output, Eigen::Matrix4f::Identity());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+VoxelizedGICP::align(cloud_t &output, const Eigen::Matrix4f &guess)
+{
+    prepare();
+    transformation_ = guess;
+    converged_ = false;
+    Convergence convergence(transformation_epsilon_, euclidean_fitness_epsilon_);
+    for (int iteration = 0; iteration < maximum_iterations_; ++iteration) {
+        const NormalEquations system = linearize(transformation_);
+        if (system.correspondences < 6) {
+            break;
+        }
+        const Eigen::Matrix<double, 6, 1> delta = system.solve();
+        apply_left_step(delta, transformation_);
+        if (convergence.converged(delta, system.squared_error / system.correspondences)) {
+            converged_ = true;
+            break;
+        }
+    }
+    pcl::transformPointCloudWithNormals(*source_, output, transformation_);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+double
+VoxelizedGICP::getFitnessScore(double max_range) const
+{
+    const Eigen::Matrix3f rotation = transformation_.topLeftCorner<3, 3>();
+    const Eigen::Vector3f translation = transformation_.col(3).head<3>();
+    const long n = static_cast<long>(source_->size());
+
+    double squared_distances = 0;
+    long correspondences = 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) reduction(+:squared_distances, correspondences)
+#endif
+    for (long i = 0; i < n; ++i) {
+        const Eigen::Vector3f p = rotation * source_->points[i].getVector3fMap() + translation;
+        const std::ptrdiff_t v = target_voxels_->voxels.find(p);
+        if (v >= 0) {
+            const double distance_squared = (target_voxels_->voxels.mean(v) - p.cast<double>()).squaredNorm();
+            if (distance_squared <= max_range) {
+                squared_distances += distance_squared;
+                ++correspondences;
+            }
+        }
+    }
+    return correspondences > 0 ? squared_distances / correspondences : std::numeric_limits<double>::max();
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+std::size_t
+VoxelizedGICP::getInformationMatrix(const Eigen::Matrix4f &transformation, Eigen::Matrix<double, 6, 6> &information)
+{
+    prepare();
+
+    // The Jacobian of linearize is the negated one of Registration::information_matrix, which
+    // leaves the product unchanged
+    const NormalEquations system = linearize(transformation);
+    information = system.H;
+    return system.correspondences;
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+#include "gauss_newton.h"
+#include "voxel_map.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Voxels of a cloud at one resolution with their covariances regularized to planes, NaN for voxels
+// with too few points. A target is aggregated once per cloud and resolution, PreparedCloud keeps it.
+struct VoxelCovariances
+{
+    typedef std::shared_ptr<const VoxelCovariances> ConstPtr;
+
+    VoxelCovariances(const pcl::PointCloud<pcl::PointNormal> &cloud, float resolution);
+
+    VoxelMap voxels;
+    std::vector<Eigen::Matrix3d> covariances;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Voxelized generalized ICP. The target is aggregated once into a VoxelMap with per-voxel mean and
+// covariance, which can be handed over to reuse it across alignments. A source point corresponds to
+// the target voxel it falls into, so there is no kd-tree at all. Source covariances are those of the source voxels at the same resolution. Both
+// are regularized to planes like in GICP. The voxel size is the maximum correspondence distance.
+// The iterations run on all OpenMP threads with per-thread sums. The interface follows
+// pcl::Registration so it can be used wherever the PCL classes are.
+class VoxelizedGICP
+{
+public:
+    typedef pcl::PointCloud<pcl::PointNormal> cloud_t;
+
+    VoxelizedGICP();
+
+    void setTransformationEpsilon(double epsilon) { transformation_epsilon_ = epsilon; }
+    void setEuclideanFitnessEpsilon(double epsilon) { euclidean_fitness_epsilon_ = epsilon; }
+    void setMaximumIterations(int iterations) { maximum_iterations_ = iterations; }
+
+    // Voxel size of the target and source maps
+    void setMaxCorrespondenceDistance(double distance);
+    double getMaxCorrespondenceDistance() const { return resolution_; }
+
+    // Not used, the voxel association has no outliers beyond the voxel size
+    void setRANSACOutlierRejectionThreshold(double) {}
+
+    void
+    setInputTarget(const cloud_t::ConstPtr &target);
+
+    // As above with the voxels of the target at the maximum correspondence distance
+    void
+    setInputTarget(const cloud_t::ConstPtr &target, const VoxelCovariances::ConstPtr &voxels);
+
+    void
+    setInputSource(const cloud_t::ConstPtr &source);
+
+    void
+    align(cloud_t &output);
+
+    void
+    align(cloud_t &output, const Eigen::Matrix4f &guess);
+
+    Eigen::Matrix4f getFinalTransformation() const { return transformation_; }
+    bool            hasConverged() const { return converged_; }
+
+    // Mean squared distance of the aligned source points to the mean of their target voxel
+    double
+    getFitnessScore(double max_range = std::numeric_limits<double>::max()) const;
+
+    // Information matrix of the alignment at transformation, ordered (translation, rotation): the
+    // Gauss-Newton matrix of the voxel correspondences weighted by their combined covariances.
+    // Returns the number of correspondences.
+    std::size_t
+    getInformationMatrix(const Eigen::Matrix4f &transformation, Eigen::Matrix<double, 6, 6> &information);
+
+private:
+    // Aggregates the target and the source at the current resolution if they changed
+    void
+    prepare();
+
+    // Gauss-Newton system of the correspondences at `transformation`
+    NormalEquations
+    linearize(const Eigen::Matrix4f &transformation) const;
+
+    double transformation_epsilon_;
+    double euclidean_fitness_epsilon_;
+    int maximum_iterations_;
+    float resolution_;
+
+    cloud_t::ConstPtr target_;
+    cloud_t::ConstPtr source_;
+
+    // Target voxels with their regularized covariance, aggregated when the resolution changes
+    VoxelCovariances::ConstPtr target_voxels_;
+
+    // Regularized covariance of the source voxel of every source point, NaN if it has too few points
+    std::vector<Eigen::Matrix3d> source_covariances_;
+    bool source_prepared_;
+
+    Eigen::Matrix4f transformation_;
+    bool converged_;
+};
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,269 @@
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <pcl/io/pcd_io.h>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+#include "voxel_map.h"
+
+// Bits per axis in a voxel key, the voxel coordinates are stored with an offset
+constexpr int key_bits = 21;
+constexpr std::int64_t key_offset = std::int64_t(1) << (key_bits - 1);
+constexpr std::uint64_t key_mask = (std::uint64_t(1) << key_bits) - 1;
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+VoxelMap::VoxelMap(float resolution, bool covariance)
+    : resolution_{resolution},
+      covariance_{covariance}
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+VoxelMap::clear()
+{
+    index_.clear();
+    sum_.clear();
+    outer_.clear();
+    count_.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+VoxelMap::key_t
+VoxelMap::key(std::int64_t x, std::int64_t y, std::int64_t z) const
+{
+    return  (static_cast<std::uint64_t>(x + key_offset) & key_mask)
+         | ((static_cast<std::uint64_t>(y + key_offset) & key_mask) << key_bits)
+         | ((static_cast<std::uint64_t>(z + key_offset) & key_mask) << (2 * key_bits));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+VoxelMap::key_t
+VoxelMap::key(const Eigen::Vector3d &point, double resolution) const
+{
+    return key(static_cast<std::int64_t>(std::floor(point.x() / resolution)),
+               static_cast<std::int64_t>(std::floor(point.y() / resolution)),
+               static_cast<std::int64_t>(std::floor(point.z() / resolution)));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template <typename PointT>
+void
+VoxelMap::insert_points(const pcl::PointCloud<PointT> &cloud, const Eigen::Matrix4f &pose)
+{
+    const Eigen::Matrix3d rotation = pose.topLeftCorner<3, 3>().cast<double>();
+    const Eigen::Vector3d translation = pose.col(3).head<3>().cast<double>();
+    index_.reserve(index_.size() + cloud.size() / 4);
+
+    for (std::size_t i = 0; i < cloud.size(); ++i) {
+        const PointT &p = cloud.points[i];
+        if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z)) {
+            continue;
+        }
+        const Eigen::Vector3d point = rotation * Eigen::Vector3d(p.x, p.y, p.z) + translation;
+
+        const std::pair<std::unordered_map<key_t, std::size_t>::iterator, bool> voxel =
+            index_.insert(std::make_pair(key(point, resolution_), count_.size()));
+        const std::size_t v = voxel.first->second;
+        if (voxel.second) {
+            sum_.push_back(Eigen::Vector3d::Zero());
+            count_.push_back(0);
+            if (covariance_) {
+                outer_.push_back(Eigen::Matrix3d::Zero());
+            }
+        }
+        sum_[v] += point;
+        ++count_[v];
+        if (covariance_) {
+            outer_[v] += point * point.transpose();
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+VoxelMap::insert(const pcl::PointCloud<pcl::PointXYZ> &cloud, const Eigen::Matrix4f &pose)
+{
+    insert_points(cloud, pose);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+VoxelMap::insert(const pcl::PointCloud<pcl::PointNormal> &cloud, const Eigen::Matrix4f &pose)
+{
+    insert_points(cloud, pose);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+std::ptrdiff_t
+VoxelMap::find(const Eigen::Vector3f &point) const
+{
+    const std::unordered_map<key_t, std::size_t>::const_iterator voxel = index_.find(key(point.cast<double>(), resolution_));
+    return voxel == index_.end() ? -1 : static_cast<std::ptrdiff_t>(voxel->second);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+Eigen::Matrix3d
+VoxelMap::covariance(std::size_t voxel) const
+{
+    const Eigen::Vector3d centroid = mean(voxel);
+    return outer_[voxel] / count_[voxel] - centroid * centroid.transpose();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+bool
+VoxelMap::nearest(const Eigen::Vector3f &point, Eigen::Vector3f &centroid) const
+{
+    const std::int64_t x = static_cast<std::int64_t>(std::floor(point.x() / resolution_));
+    const std::int64_t y = static_cast<std::int64_t>(std::floor(point.y() / resolution_));
+    const std::int64_t z = static_cast<std::int64_t>(std::floor(point.z() / resolution_));
+
+    float best = std::numeric_limits<float>::max();
+    for (std::int64_t dx = -1; dx <= 1; ++dx) {
+        for (std::int64_t dy = -1; dy <= 1; ++dy) {
+            for (std::int64_t dz = -1; dz <= 1; ++dz) {
+                const std::unordered_map<key_t, std::size_t>::const_iterator voxel = index_.find(key(x + dx, y + dy, z + dz));
+                if (voxel == index_.end()) {
+                    continue;
+                }
+                const Eigen::Vector3f c = (sum_[voxel->second] / count_[voxel->second]).cast<float>();
+                const float distance = (c - point).squaredNorm();
+                if (distance < best) {
+                    best = distance;
+                    centroid = c;
+                }
+            }
+        }
+    }
+    return best < std::numeric_limits<float>::max();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+VoxelMap::merge(float resolution,
+                std::vector<Eigen::Vector3d> &sum,
+                std::vector<Eigen::Matrix3d> &outer,
+                std::vector<std::uint32_t> &count) const
+{
+    if (resolution <= resolution_) {
+        sum = sum_;
+        outer = outer_;
+        count = count_;
+        return;
+    }
+
+    // The aggregates are additive, a coarse voxel is the sum of the fine voxels whose centroid it contains
+    std::unordered_map<key_t, std::size_t> index;
+    sum.clear();
+    outer.clear();
+    count.clear();
+    for (std::size_t v = 0; v < count_.size(); ++v) {
+        const std::pair<std::unordered_map<key_t, std::size_t>::iterator, bool> voxel =
+            index.insert(std::make_pair(key(sum_[v] / count_[v], resolution), count.size()));
+        const std::size_t w = voxel.first->second;
+        if (voxel.second) {
+            sum.push_back(Eigen::Vector3d::Zero());
+            count.push_back(0);
+            if (covariance_) {
+                outer.push_back(Eigen::Matrix3d::Zero());
+            }
+        }
+        sum[w] += sum_[v];
+        count[w] += count_[v];
+        if (covariance_) {
+            outer[w] += outer_[v];
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+VoxelMap::export_cloud(pcl::PointCloud<pcl::PointXYZ> &cloud, float resolution) const
+{
+    std::vector<Eigen::Vector3d> sum;
+    std::vector<Eigen::Matrix3d> outer;
+    std::vector<std::uint32_t> count;
+    merge(resolution, sum, outer, count);
+
+    cloud.clear();
+    cloud.reserve(count.size());
+    for (std::size_t v = 0; v < count.size(); ++v) {
+        const Eigen::Vector3d centroid = sum[v] / count[v];
+        cloud.push_back(pcl::PointXYZ(centroid.x(), centroid.y(), centroid.z()));
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+VoxelMap::export_cloud(pcl::PointCloud<pcl::PointNormal> &cloud, float resolution) const
+{
+    std::vector<Eigen::Vector3d> sum;
+    std::vector<Eigen::Matrix3d> outer;
+    std::vector<std::uint32_t> count;
+    merge(resolution, sum, outer, count);
+
+    cloud.clear();
+    cloud.reserve(count.size());
+    for (std::size_t v = 0; v < count.size(); ++v) {
+        const Eigen::Vector3d centroid = sum[v] / count[v];
+        pcl::PointNormal p;
+        p.x = centroid.x();
+        p.y = centroid.y();
+        p.z = centroid.z();
+
+        // Normals need at least three points, like in PCL invalid normals are NaN
+        p.normal_x = p.normal_y = p.normal_z = p.curvature = std::numeric_limits<float>::quiet_NaN();
+        if (covariance_ && count[v] >= 3) {
+            const Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(outer[v] / count[v] - centroid * centroid.transpose());
+            const Eigen::Vector3d normal = solver.eigenvectors().col(0);
+            const double eigenvalues_sum = solver.eigenvalues().sum();
+            p.normal_x = normal.x();
+            p.normal_y = normal.y();
+            p.normal_z = normal.z();
+            p.curvature = eigenvalues_sum > 0 ? solver.eigenvalues()(0) / eigenvalues_sum : 0;
+        }
+        cloud.push_back(p);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+VoxelMap::export_region(pcl::PointCloud<pcl::PointXYZ> &cloud, const Eigen::Matrix4f &pose, float radius) const
+{
+    const Eigen::Matrix3d rotation = pose.topLeftCorner<3, 3>().cast<double>();
+    const Eigen::Vector3d translation = pose.col(3).head<3>().cast<double>();
+    const double radius_squared = static_cast<double>(radius) * radius;
+
+    cloud.clear();
+    for (std::size_t v = 0; v < count_.size(); ++v) {
+        const Eigen::Vector3d centroid = rotation * (sum_[v] / count_[v]) + translation;
+        if (radius > 0 && centroid.squaredNorm() > radius_squared) {
+            continue;
+        }
+        cloud.push_back(pcl::PointXYZ(centroid.x(), centroid.y(), centroid.z()));
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void
+VoxelMap::save(const std::string &path, float resolution) const
+{
+    if (covariance_) {
+        pcl::PointCloud<pcl::PointNormal> cloud;
+        export_cloud(cloud, resolution);
+        pcl::io::savePCDFileBinary(path, cloud);
+    } else {
+        pcl::PointCloud<pcl::PointXYZ> cloud;
+        export_cloud(cloud, resolution);
+        pcl::io::savePCDFileBinary(path, cloud);
+    }
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#if defined __GNUC__ || defined __APPLE__
+#include <Eigen/Dense>
+#else
+#include <eigen3/Eigen/Dense>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Map of points aggregated in a spatial hash of cubic voxels. A voxel keeps the sum and the number
+// of its points and, if enabled, the sum of their outer products, so points are inserted in O(1)
+// and overlapping fragments do not store the same surface several times. The aggregates are
+// additive, which allows exporting the map at any multiple of the voxel size.
+class VoxelMap
+{
+public:
+    explicit VoxelMap(float resolution, bool covariance = false);
+
+    float       resolution() const { return resolution_; }
+    std::size_t size() const { return count_.size(); }
+    bool        empty() const { return count_.empty(); }
+
+    void
+    clear();
+
+    // Inserts the cloud transformed by pose
+    void
+    insert(const pcl::PointCloud<pcl::PointXYZ> &cloud, const Eigen::Matrix4f &pose = Eigen::Matrix4f::Identity());
+
+    void
+    insert(const pcl::PointCloud<pcl::PointNormal> &cloud, const Eigen::Matrix4f &pose = Eigen::Matrix4f::Identity());
+
+    // Centroid of the voxel closest to point among the voxel containing it and its 26 neighbours.
+    // Returns false if none of them is occupied.
+    bool
+    nearest(const Eigen::Vector3f &point, Eigen::Vector3f &centroid) const;
+
+    // Index of the voxel containing point, -1 if it is empty
+    std::ptrdiff_t
+    find(const Eigen::Vector3f &point) const;
+
+    std::uint32_t count(std::size_t voxel) const { return count_[voxel]; }
+
+    Eigen::Vector3d
+    mean(std::size_t voxel) const { return sum_[voxel] / count_[voxel]; }
+
+    // Sample covariance of the voxel points. Requires covariance.
+    Eigen::Matrix3d
+    covariance(std::size_t voxel) const;
+
+    // One point per voxel of size `resolution` (0: the map resolution) at the centroid of its points
+    void
+    export_cloud(pcl::PointCloud<pcl::PointXYZ> &cloud, float resolution = 0) const;
+
+    // As above, with the normal and curvature of the voxel points. Requires covariance.
+    void
+    export_cloud(pcl::PointCloud<pcl::PointNormal> &cloud, float resolution = 0) const;
+
+    // The voxel centroids transformed by pose, only those within radius of the origin after the
+    // transformation (radius <= 0: all of them)
+    void
+    export_region(pcl::PointCloud<pcl::PointXYZ> &cloud, const Eigen::Matrix4f &pose, float radius = 0) const;
+
+    void
+    save(const std::string &path, float resolution = 0) const;
+
+private:
+    typedef std::uint64_t key_t;
+
+    template <typename PointT>
+    void
+    insert_points(const pcl::PointCloud<PointT> &cloud, const Eigen::Matrix4f &pose);
+
+    key_t
+    key(const Eigen::Vector3d &point, double resolution) const;
+
+    key_t
+    key(std::int64_t x, std::int64_t y, std::int64_t z) const;
+
+    // Voxel aggregates summed up into voxels of the given resolution
+    void
+    merge(float resolution,
+          std::vector<Eigen::Vector3d> &sum,
+          std::vector<Eigen::Matrix3d> &outer,
+          std::vector<std::uint32_t> &count) const;
+
+    float resolution_;
+    bool covariance_;
+
+    // Voxel index of each occupied key
+    std::unordered_map<key_t, std::size_t> index_;
+
+    // Voxel aggregates
+    std::vector<Eigen::Vector3d> sum_;
+    std::vector<Eigen::Matrix3d> outer_;
+    std::vector<std::uint32_t> count_;
+};
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////